@@ -0,0 +1,411 @@
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include "geometry.h"
+#include "model.h"
+#include "our_gl.h"
+#include "ssao.h"
+#include "texture.h"
+#include "tgaimage.h"
+#include "vertex_cache.h"
+
+// Micro and end-to-end benchmarks, one result per line on stdout (CSV, or JSON lines with --json):
+//   benchmark,iterations,ns_per_op,items_per_op,items_per_sec
+// Each benchmark runs batches of growing size until one lasts --min-time seconds (0.2 by default),
+// the figures are those of that batch. Benchmarks whose assets are missing are skipped.
+// usage: tiny-renderer-bench [--json] [--min-time seconds] [--filter substring] [--assets dir]
+// assets dir defaults to ../object (the object/ directory seen from a build directory); the loading messages of
+// Model go to stderr as usual.
+
+namespace {
+    bool json = false;
+    double min_time = .2;
+    std::string filter, assets = "../object";
+    volatile float sink; // keeps the results of the pure computations alive
+
+    double seconds_since(std::chrono::steady_clock::time_point t0) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+    }
+
+    // items: units of work of one call of fn (pixels, faces, texels...), 0 if meaningless
+    template <class F> void bench(const std::string &name, double items, F fn) {
+        if (!filter.empty() && name.find(filter)==std::string::npos) return;
+        long long iters = 1;
+        double t;
+        while (true) {
+            auto t0 = std::chrono::steady_clock::now();
+            for (long long i=0; i<iters; i++) fn();
+            t = seconds_since(t0);
+            if (t>=min_time || iters>=(1LL<<40)) break;
+            iters *= t>0 ? std::max(2LL, std::min(10LL, (long long)(min_time/t*1.2))) : 10;
+        }
+        const double ns = t*1e9/iters, rate = items*iters/t;
+        if (json)
+            std::cout << "{\"benchmark\":\"" << name << "\",\"iterations\":" << iters << ",\"ns_per_op\":" << ns
+                      << ",\"items_per_op\":" << items << ",\"items_per_sec\":" << rate << "}" << std::endl;
+        else
+            std::cout << name << "," << iters << "," << ns << "," << items << "," << rate << std::endl;
+    }
+
+    std::string asset(const std::string &name) {
+        return assets + "/" + name;
+    }
+
+    bool exists(const std::string &path) {
+        return std::filesystem::exists(path);
+    }
+
+    // pseudo-random floats in [0,1), reproducible from run to run
+    std::vector<float> random_floats(int n) {
+        std::vector<float> res(n);
+        unsigned seed = 12345;
+        for (float &f : res) f = ((seed = seed*1664525u+1013904223u)>>8)/16777216.f;
+        return res;
+    }
+
+    // UV sphere of 2*n*n triangles, written as an OBJ with v/vt/vn faces
+    bool write_sphere(const std::string &filename, int n) {
+        std::ofstream out(filename);
+        if (!out) return false;
+        for (int i=0; i<=n; i++)
+            for (int j=0; j<=n; j++) {
+                float theta = M_PI*i/n, phi = 2*M_PI*j/n;
+                float x = std::sin(theta)*std::cos(phi), y = std::cos(theta), z = std::sin(theta)*std::sin(phi);
+                out << "v " << x << " " << y << " " << z << "\nvt " << (float)j/n << " " << (float)i/n << "\nvn " << x << " " << y << " " << z << "\n";
+            }
+        for (int i=0; i<n; i++)
+            for (int j=0; j<n; j++) {
+                int a = i*(n+1)+j+1, b = a+1, c = a+n+1, d = c+1;
+                out << "f " << a << "/" << a << "/" << a << " " << c << "/" << c << "/" << c << " " << b << "/" << b << "/" << b << "\n";
+                out << "f " << b << "/" << b << "/" << b << " " << c << "/" << c << "/" << c << " " << d << "/" << d << "/" << d << "\n";
+            }
+        return out.good();
+    }
+
+    struct FlatShader {
+        static constexpr int nvaryings = 0;
+        Vec4f vertex(int, int) { return Vec4f(); }
+        bool fragment(Vec3f, Vec3f, TGAColor &color) {
+            color = TGAColor(255, 255, 255);
+            return false;
+        }
+    };
+
+    struct SmoothShader {
+        mat<3,3,float> varying_color;
+        Vec4f vertex(int, int) { return Vec4f(); }
+        bool fragment(Vec3f, Vec3f bar, TGAColor &color) {
+            Vec3f c = varying_color*bar;
+            color = TGAColor(c[0], c[1], c[2]);
+            return false;
+        }
+    };
+
+    // SmoothShader behind the virtual interface: the compatibility path of triangle()
+    struct VirtualSmoothShader : IShader {
+        SmoothShader smooth;
+        Vec4f vertex(int iface, int nthvert) override { return smooth.vertex(iface, nthvert); }
+        bool fragment(Vec3f gl_FragCoord, Vec3f bar, TGAColor &color) override { return smooth.fragment(gl_FragCoord, bar, color); }
+    };
+
+    // same colors as SmoothShader, interpolated by the rasterizer from plane equations
+    struct PlaneShader {
+        static constexpr int nvaryings = 3;
+        mat<3,3,float> varying;
+        Vec4f vertex(int, int) { return Vec4f(); }
+        bool fragment(Vec3f, const Vec3f &c, TGAColor &color) {
+            color = TGAColor(c[0], c[1], c[2]);
+            return false;
+        }
+    };
+
+    // diffuse texture modulated by a Lambert term on the vertex normals
+    struct TexturedShader {
+        const Model *model;
+        const Texture *diffuse;
+        Matrix mvp;
+        Vec3f light;
+        mat<2,3,float> varying_uv;
+        Vec3f varying_ity;
+        Vec4f vertex(int iface, int nthvert) {
+            varying_uv.set_col(nthvert, model->uv(iface, nthvert));
+            varying_ity[nthvert] = std::max(0.f, model->normal(iface, nthvert)*light);
+            return mvp*embed<4>(model->vert(iface, nthvert));
+        }
+        bool fragment(Vec3f, Vec3f bar, TGAColor &color) {
+            color = diffuse->sample(varying_uv*bar)*(varying_ity*bar);
+            return false;
+        }
+    };
+
+    void setup_camera(RenderContext &ctx, Vec3f eye) {
+        const Vec3f center(0, 0, 0), up(0, 1, 0);
+        lookat(ctx, eye, center, up);
+        viewport(ctx, ctx.width()/8, ctx.height()/8, ctx.width()*3/4, ctx.height()*3/4);
+        projection(ctx, -1.f/(eye-center).norm());
+    }
+
+    void bench_barycentric() {
+        const int n = 4096;
+        std::vector<float> r = random_floats(2*n);
+        const Vec2f A(10, 10), B(500, 60), C(200, 400);
+        bench("barycentric", n, [&]() {
+            float acc = 0;
+            for (int i=0; i<n; i++) acc += barycentric(A, B, C, Vec2f(r[2*i]*512, r[2*i+1]*512)).x;
+            sink = acc;
+        });
+    }
+
+    // triangles given in pixels, at constant depth so that every repetition passes the depth test again
+    template <class Shader> void bench_triangle(const std::string &shader_name, Shader &shader) {
+        const int size = 1024;
+        RenderContext ctx(size, size);
+        viewport(ctx, 0, 0, size, size);
+        struct Shape { const char *name; float pts[3][2]; };
+        const Shape shapes[] = {
+            {"right_8px",     {{100, 100}, {108, 100}, {100, 108}}},
+            {"right_32px",    {{100, 100}, {132, 100}, {100, 132}}},
+            {"right_128px",   {{100, 100}, {228, 100}, {100, 228}}},
+            {"right_512px",   {{100, 100}, {612, 100}, {100, 612}}},
+            {"equilateral_256px", {{100, 700}, {356, 700}, {228, 478}}},
+            {"sliver_512x4px", {{100, 900}, {612, 904}, {100, 904}}},
+            {"diagonal_sliver", {{10, 10}, {1000, 990}, {14, 30}}},
+        };
+        for (const Shape &s : shapes) {
+            mat<4,3,float> clipc;
+            for (int j=0; j<3; j++) {
+                Vec4f v;
+                v[0] = s.pts[j][0]/(size/2.f)-1.f; v[1] = s.pts[j][1]/(size/2.f)-1.f; v[2] = 0; v[3] = 1;
+                clipc.set_col(j, v);
+            }
+            ctx.clear();
+            const int pixels = triangle(ctx, clipc, shader);
+            bench(std::string("triangle/")+shader_name+"/"+s.name, pixels, [&]() { triangle(ctx, clipc, shader); });
+        }
+    }
+
+    void bench_triangles() {
+        FlatShader flat;
+        SmoothShader smooth;
+        PlaneShader plane;
+        for (int j=0; j<3; j++) smooth.varying_color.set_col(j, Vec3f(j==0 ? 255 : 0, j==1 ? 255 : 0, j==2 ? 255 : 0));
+        plane.varying = smooth.varying_color;
+        VirtualSmoothShader virtual_smooth;
+        virtual_smooth.smooth = smooth;
+        IShader &ishader = virtual_smooth;
+        DepthShader depth;
+        bench_triangle("flat", flat);
+        bench_triangle("smooth", smooth);
+        bench_triangle("ishader/smooth", ishader); // Shader = IShader: the non-template overload
+        bench_triangle("plane", plane);
+        bench_triangle("depth", depth);
+    }
+
+    void bench_geometry() {
+        const int n = 1024;
+        std::vector<float> r = random_floats(16*n);
+        std::vector<Vec3f> v3(n);
+        std::vector<Vec4f> v4(n);
+        std::vector<Matrix> m4(n);
+        for (int i=0; i<n; i++) {
+            v3[i] = Vec3f(r[3*i], r[3*i+1], r[3*i+2]);
+            for (int j=0; j<4; j++) v4[i][j] = r[4*i+j];
+            for (int j=0; j<16; j++) m4[i][j/4][j%4] = r[16*i+j] + (j%5==0 ? 4.f : 0.f); // well conditioned
+        }
+        bench("geometry/vec3_dot", n, [&]() {
+            float acc = 0;
+            for (int i=0; i<n; i++) acc += v3[i]*v3[(i+1)%n];
+            sink = acc;
+        });
+        bench("geometry/vec3_cross_normalize", n, [&]() {
+            float acc = 0;
+            for (int i=0; i<n; i++) acc += cross(v3[i], v3[(i+1)%n]).normalize().x;
+            sink = acc;
+        });
+        bench("geometry/mat4_vec4", n, [&]() {
+            float acc = 0;
+            for (int i=0; i<n; i++) acc += (m4[i]*v4[i])[3];
+            sink = acc;
+        });
+        bench("geometry/mat4_mat4", n, [&]() {
+            float acc = 0;
+            for (int i=0; i<n; i++) acc += (m4[i]*m4[(i+1)%n])[3][3];
+            sink = acc;
+        });
+        bench("geometry/mat4_invert", n, [&]() {
+            float acc = 0;
+            for (int i=0; i<n; i++) acc += m4[i].invert()[0][0];
+            sink = acc;
+        });
+        bench("geometry/mat4_invert_transpose", n, [&]() {
+            float acc = 0;
+            for (int i=0; i<n; i++) acc += m4[i].invert_transpose()[0][0];
+            sink = acc;
+        });
+    }
+
+    void bench_models(const std::vector<std::string> &models) {
+        for (const std::string &path : models) {
+            const std::string name = std::filesystem::path(path).stem().string();
+            int faces = Model(path.c_str()).nfaces();
+            bench("obj_parse/"+name, faces, [&]() { Model m(path.c_str()); sink = m.nfaces(); });
+            const std::string mesh = "bench_"+name+".mesh";
+            {
+                Model m(path.c_str());
+                if (!m.save_mesh(mesh.c_str())) continue;
+            }
+            bench("mesh_load/"+name, faces, [&]() { Model m(mesh.c_str()); sink = m.nfaces(); });
+            remove(mesh.c_str());
+        }
+    }
+
+    void bench_texture() {
+        TGAImage img;
+        const std::string path = asset("african_head/african_head_diffuse.tga");
+        if (!exists(path) || !img.read_tga_file(path.c_str())) return;
+        Texture tex;
+        tex.load(img);
+        const int n = 4096;
+        std::vector<float> r = random_floats(2*n);
+        // a coherent walk (neighbouring pixels of a row) and random lookups
+        const struct { const char *name; TextureFilter filter; } filters[] = {{"nearest", NEAREST}, {"bilinear", BILINEAR}, {"trilinear", TRILINEAR}};
+        for (auto f : filters) {
+            bench(std::string("texture/")+f.name+"/coherent", n, [&]() {
+                unsigned acc = 0;
+                for (int i=0; i<n; i++) acc += tex.sample(Vec2f((i%64)/1024.f+.3f, (i/64)/1024.f+.3f), 1.5f, f.filter)[0];
+                sink = acc;
+            });
+            bench(std::string("texture/")+f.name+"/random", n, [&]() {
+                unsigned acc = 0;
+                for (int i=0; i<n; i++) acc += tex.sample(Vec2f(r[2*i], r[2*i+1]), 1.5f, f.filter)[0];
+                sink = acc;
+            });
+        }
+        bench("texture/mipmap_build", (double)img.get_width()*img.get_height(), [&]() { Texture t; t.load(img); sink = t.levels(); });
+    }
+
+    void bench_tga() {
+        const char *names[] = {"african_head/african_head_diffuse.tga", "african_head/african_head_nm.tga", "african_head/african_head_spec.tga"};
+        for (const char *n : names) {
+            const std::string path = asset(n);
+            TGAImage img;
+            if (!exists(path) || !img.read_tga_file(path.c_str())) continue;
+            const std::string name = std::filesystem::path(path).stem().string();
+            const double pixels = (double)img.get_width()*img.get_height();
+            bench("tga/read/"+name, pixels, [&]() { TGAImage i; i.read_tga_file(path.c_str()); });
+            bench("tga/write_rle/"+name, pixels, [&]() { img.write_tga_file("bench_tmp.tga"); });
+            bench("tga/write_raw/"+name, pixels, [&]() { img.write_tga_file("bench_tmp.tga", false); });
+        }
+        remove("bench_tmp.tga");
+    }
+
+    // depth of a model seen from the default camera of tiny-renderer
+    void depth_frame(RenderContext &ctx, const Model &model, VertexCache &clip, int nthreads) {
+        ctx.clear();
+        setup_camera(ctx, Vec3f(0, 0, 2));
+        DrawParams params;
+        params.nthreads = nthreads;
+        params.front_to_back = true;
+        params.cull_backfaces = true;
+        clip.transform(model, ctx.Projection*ctx.ModelView, nthreads);
+        draw_depth(ctx, clip, params);
+    }
+
+    void bench_ssao(const std::string &path) {
+        if (!exists(path)) return;
+        Model model(path.c_str());
+        const int size = 800;
+        RenderContext ctx(size, size, false);
+        ctx.model = &model;
+        VertexCache clip;
+        depth_frame(ctx, model, clip, 0);
+        std::vector<float> ao(size*size);
+        for (int nsamples : {4, 8}) {
+            SSAOParams params;
+            params.nsamples = nsamples;
+            bench("ssao/"+std::to_string(size)+"px/"+std::to_string(nsamples)+"dirs", size*size,
+                  [&]() { ssao(ctx.zbuffer.data(), size, size, ao.data(), params); });
+        }
+    }
+
+    // end to end: depth pass and textured forward pass of whole models, 800x800, all cores
+    void bench_frames(const std::vector<std::string> &models) {
+        const int size = 800;
+        for (const std::string &path : models) {
+            const std::string name = std::filesystem::path(path).stem().string();
+            Model model(path.c_str());
+            std::shared_ptr<const Texture> diffuse = model.diffusemap();
+            RenderContext ctx(size, size);
+            ctx.model = &model;
+            VertexCache clip;
+            bench("frame/depth/"+name, model.nfaces(), [&]() { depth_frame(ctx, model, clip, 0); });
+            if (diffuse->empty()) continue;
+            TexturedShader shader;
+            shader.model = &model;
+            shader.diffuse = diffuse.get();
+            shader.light = Vec3f(1, 1, 1).normalize();
+            bench("frame/textured/"+name, model.nfaces(), [&]() {
+                ctx.clear();
+                setup_camera(ctx, Vec3f(1, 1, 3));
+                shader.mvp = ctx.Projection*ctx.ModelView;
+                DrawParams params;
+                params.cull_backfaces = true;
+                draw(ctx, shader, params);
+            });
+        }
+    }
+
+    // scaling with the triangle count: spheres of 2k to 2M faces filling the same screen area
+    void bench_dense() {
+        const int size = 800;
+        RenderContext ctx(size, size);
+        VertexCache clip;
+        for (int n : {32, 64, 128, 256, 512, 1024}) {
+            const std::string name = "sphere_"+std::to_string(2*n*n);
+            if (!filter.empty() && ("frame/dense/"+name).find(filter)==std::string::npos) continue;
+            const std::string obj = "bench_"+name+".obj";
+            if (!write_sphere(obj, n)) continue;
+            Model model(obj.c_str());
+            remove(obj.c_str());
+            ctx.model = &model;
+            bench("frame/dense/"+name, model.nfaces(), [&]() { depth_frame(ctx, model, clip, 0); });
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    for (int i=1; i<argc; i++) {
+        std::string arg = argv[i];
+        if (arg=="--json") json = true;
+        else if (arg=="--min-time" && i+1<argc) min_time = atof(argv[++i]);
+        else if (arg=="--filter" && i+1<argc) filter = argv[++i];
+        else if (arg=="--assets" && i+1<argc) assets = argv[++i];
+        else {
+            std::cerr << "usage: " << argv[0] << " [--json] [--min-time seconds] [--filter substring] [--assets dir]" << std::endl;
+            return 1;
+        }
+    }
+    std::vector<std::string> models;
+    for (const char *name : {"african_head/african_head.obj", "diablo3_pose/diablo3_pose.obj", "boggie/body.obj"})
+        if (exists(asset(name))) models.push_back(asset(name));
+
+    if (!json) std::cout << "benchmark,iterations,ns_per_op,items_per_op,items_per_sec" << std::endl;
+    bench_barycentric();
+    bench_triangles();
+    bench_geometry();
+    bench_models(models);
+    bench_texture();
+    bench_tga();
+    if (!models.empty()) bench_ssao(models.back());
+    bench_frames(models);
+    bench_dense();
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include <cmath>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include "model.h"
+#include "our_gl.h"
+#include "instancing.h"
+#include "vertex_cache.h"
+
+// Instanced rendering demo: a grid of n x n copies of a model with random headings, sizes and tints, seen from
+// above one corner so that part of the grid falls outside the view. The frame is drawn once with draw_instanced()
+// and once copy by copy (a transform and a draw() per instance) for comparison, then written to crowd.tga.
+// Last, a few stretched and sheared copies are drawn with draw_instanced() and with a plain draw() per copy
+// (ReferenceShader) to check the lighting of non-uniform transforms.
+// usage: crowd [model.obj [n]]
+
+// one copy drawn on its own, its normals transformed by the inverse transpose of the full 4x4 transform
+struct ReferenceShader {
+    static constexpr int nvaryings = 1;
+    const Model *model;
+    Matrix mvp, normal_matrix;
+    Vec3f light;
+    TGAColor tint;
+    mat<1,3,float> varying;
+
+    Vec4f vertex(int iface, int nthvert) {
+        Vec3f n = proj<3>(normal_matrix*embed<4>(model->normal(iface, nthvert), 0.f)).normalize();
+        varying[0][nthvert] = std::max(0.f, n*light);
+        return mvp*embed<4>(model->vert(iface, nthvert));
+    }
+    bool fragment(Vec3f, const vec<1,float> &ity, TGAColor &color) {
+        color = tint*ity[0];
+        return false;
+    }
+};
+
+static double ms_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-t0).count();
+}
+
+int main(int argc, char** argv) {
+    const char *filename = argc>1 ? argv[1] : "../object/african_head/african_head.obj";
+    const int n = argc>2 ? atoi(argv[2]) : 16, width = 1024, height = 768;
+    Model model(filename);
+    if (!model.nfaces() || n<1) return 1;
+
+    std::vector<Instance> instances(n*n);
+    unsigned seed = 1;
+    auto random = [&]() { return ((seed = seed*1664525u+1013904223u)>>8)/16777216.f; };
+    const float spacing = 4.f/n; // the grid spans [-2,2]^2, the view about [-1,1]^2 around its center
+    for (int i=0; i<n*n; i++) {
+        float angle = random()*2*M_PI, scale = (.8f + .4f*random())*spacing*.45f;
+        Matrix &t = instances[i].transform;
+        t = Matrix::identity();
+        t[0][0] = std::cos(angle)*scale; t[0][2] = std::sin(angle)*scale;
+        t[2][0] = -std::sin(angle)*scale; t[2][2] = std::cos(angle)*scale;
+        t[1][1] = scale;
+        t[0][3] = (i%n - (n-1)/2.f)*spacing;
+        t[2][3] = (i/n - (n-1)/2.f)*spacing;
+        instances[i].tint = TGAColor(100+155*random(), 100+155*random(), 100+155*random());
+    }
+
+    RenderContext ctx(width, height);
+    ctx.model = &model;
+    Vec3f eye(1.2f, 1.f, 1.8f), center(-.3f, 0, -.3f), light(1, 1, .5);
+    lookat(ctx, eye, center, Vec3f(0, 1, 0));
+    viewport(ctx, 0, 0, width, height);
+    projection(ctx, -1.f/(eye-center).norm());
+    DrawParams params;
+    params.cull_backfaces = true;
+
+    VertexCache clip;
+    auto t0 = std::chrono::steady_clock::now();
+    InstanceStats stats = draw_instanced(ctx, instances, clip, light, params);
+    double instanced_ms = ms_since(t0);
+    ctx.framebuffer.to_image().write_tga_file("crowd.tga", true, true);
+
+    // the same frame, one copy at a time
+    ctx.clear();
+    std::vector<Instance> one(1);
+    t0 = std::chrono::steady_clock::now();
+    for (const Instance &inst : instances) {
+        one[0] = inst;
+        draw_instanced(ctx, one, clip, light, params);
+    }
+    double loop_ms = ms_since(t0);
+
+    std::vector<Instance> stretched(3);
+    for (int i=0; i<3; i++) {
+        Matrix &t = stretched[i].transform;
+        t[0][0] = .5f - .15f*i; t[1][1] = .15f + .1f*i; t[2][2] = .3f; // non-uniform scales
+        t[0][1] = .2f*i; t[1][2] = -.1f*i;                           // and shears
+        t[0][3] = -.9f + .6f*i; t[2][3] = -.3f;
+        stretched[i].tint = TGAColor(255, 200+20*i, 150);
+    }
+    ctx.clear();
+    draw_instanced(ctx, stretched, clip, light, params);
+    RenderContext ref(width, height);
+    ref.model = &model;
+    ref.ModelView = ctx.ModelView; ref.Projection = ctx.Projection; ref.Viewport = ctx.Viewport;
+    for (Instance inst : stretched) {
+        ReferenceShader shader;
+        shader.model = &model;
+        shader.mvp = ctx.Projection*ctx.ModelView*inst.transform;
+        shader.normal_matrix = inst.transform.invert_transpose();
+        shader.light = light.normalize();
+        shader.tint = inst.tint;
+        draw(ref, shader, params);
+    }
+    int differ = 0, maxdiff = 0;
+    for (int y=0; y<height; y++)
+        for (int x=0; x<width; x++) {
+            TGAColor a = ctx.framebuffer.get(x, y), b = ref.framebuffer.get(x, y);
+            int d = 0;
+            for (int i=0; i<3; i++) d = std::max(d, std::abs(a[i]-b[i]));
+            maxdiff = std::max(maxdiff, d);
+            differ += d>0;
+        }
+
+    std::cout << "instances: " << stats.instances << ", " << stats.culled << " culled by bounding sphere" << std::endl
+              << "triangles: " << stats.triangles.triangles << " submitted, " << stats.triangles.frustum << " outside the frustum, "
+              << stats.triangles.backface << " back faces, " << stats.triangles.rasterized << " rasterized" << std::endl
+              << "instanced draw: " << instanced_ms << " ms, copy by copy: " << loop_ms << " ms" << std::endl
+              << "stretched copies against draw(): " << differ << " pixels differ, max channel difference " << maxdiff << std::endl;
+    return maxdiff>1;
+}
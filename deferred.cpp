@@ -0,0 +1,16 @@
+#include <algorithm>
+#include "deferred.h"
+
+VisibilityBuffer::VisibilityBuffer(int w, int h) : width(w), height(h), face(w*h, -1), bar1(w*h), bar2(w*h) {}
+
+void VisibilityBuffer::clear() {
+    std::fill(face.begin(), face.end(), -1);
+}
+
+DrawStats draw_visibility(RenderContext &ctx, const VertexCache &clip, VisibilityBuffer &vis, const DrawParams &params) {
+    VisibilityShader shader;
+    shader.model = ctx.model;
+    shader.clip = &clip;
+    shader.vis = &vis;
+    return draw(ctx, shader, params);
+}
@@ -0,0 +1,95 @@
+#ifndef __DEFERRED_H__
+#define __DEFERRED_H__
+#include <vector>
+#include "our_gl.h"
+
+// Visibility buffer of a deferred pass: the face of ctx.model that won the depth test at every pixel and its
+// perspective-correct barycentric coordinates (b0 = 1-b1-b2), 12 bytes a pixel.
+struct VisibilityBuffer {
+    int width, height;
+    std::vector<int> face; // -1 where nothing was drawn
+    std::vector<float> bar1, bar2;
+
+    VisibilityBuffer(int w, int h);
+    void clear();
+};
+
+// Raster shader of the visibility pass: positions from the vertex cache, the fragments only record the face
+struct VisibilityShader {
+    static constexpr bool writes_color = false;
+    const Model *model;
+    const VertexCache *clip;
+    VisibilityBuffer *vis;
+    int iface = -1;
+    Vec4f vertex(int iface_, int nthvert) {
+        iface = iface_;
+        return (*clip)[model->face(iface_)[nthvert]];
+    }
+    bool fragment(Vec3f gl_FragCoord, Vec3f bar, TGAColor &) {
+        int i = int(gl_FragCoord.x) + int(gl_FragCoord.y)*vis->width;
+        vis->face[i] = iface;
+        vis->bar1[i] = bar.y;
+        vis->bar2[i] = bar.z;
+        return false;
+    }
+};
+
+// First pass of deferred shading: fills ctx's zbuffer and vis (cleared beforehand) with the visible faces
+// of ctx.model whose vertices clip holds in clip coordinates. No color is written.
+DrawStats draw_visibility(RenderContext &ctx, const VertexCache &clip, VisibilityBuffer &vis, const DrawParams &params=DrawParams());
+
+// Second pass: runs shader.fragment() once per covered pixel of vis, with the depth of ctx's zbuffer, and writes
+// the colors to ctx.framebuffer. The rows are spread over nthreads workers, each with its own copy of the
+// shader whose vertex() is re-run whenever the face changes along a row (same contract as draw()).
+// Shaders with plane varyings (see our_gl.h) get them from the stored barycentric coordinates, and the uv
+// derivatives of their face if they use textures.
+// Returns the number of pixels shaded, 0 if ctx has no color target of the size of vis.
+template <class Shader> long long shade(RenderContext &ctx, const VisibilityBuffer &vis, Shader &shader, int nthreads=0) {
+    PROFILE_SCOPE("shade");
+    if (ctx.framebuffer.width()!=vis.width || ctx.framebuffer.height()!=vis.height) return 0;
+    const int band = 8; // rows per job
+    const int nbands = (vis.height+band-1)/band;
+    std::vector<long long> shaded(nbands);
+    parallel_for(nbands, nthreads, [&](int b) {
+        Shader s = shader;
+        TGAColor color;
+        int current = -1;
+        long long calls = 0; // profiling count, unused otherwise
+        for (int y=b*band; y<std::min((b+1)*band, vis.height); y++) {
+            uint32_t *row = ctx.framebuffer.row(y);
+            for (int x=0; x<vis.width; x++) {
+                const int i = x + y*vis.width;
+                const int f = vis.face[i];
+                if (f<0) continue;
+                if (f!=current) {
+                    Vec2f screen[3];
+                    for (int j=0; j<3; j++) {
+                        Vec4f v = ctx.Viewport*s.vertex(f, j);
+                        screen[j] = Vec2f(v[0]/v[3], v[1]/v[3]);
+                    }
+                    if constexpr (shader_uses_textures<Shader>()) {
+                        const Vec2f uv[3] = {Vec2f(s.varying[0][0], s.varying[1][0]), Vec2f(s.varying[0][1], s.varying[1][1]),
+                                             Vec2f(s.varying[0][2], s.varying[1][2])};
+                        uv_derivatives(screen, uv, s.duvdx, s.duvdy);
+                    }
+                    current = f;
+                }
+                Vec3f bar(1.f-vis.bar1[i]-vis.bar2[i], vis.bar1[i], vis.bar2[i]);
+                if constexpr (profile::enabled) calls++;
+                bool discard;
+                if constexpr (shader_plane_varyings<Shader>())
+                    discard = s.fragment(Vec3f(x, y, ctx.depth(x, y)), s.varying*bar, color);
+                else
+                    discard = s.fragment(Vec3f(x, y, ctx.depth(x, y)), bar, color);
+                if (discard) continue;
+                row[x] = RenderTarget::pack(color);
+                shaded[b]++;
+            }
+        }
+        PROFILE_COUNT(FRAGMENTS_SHADED, calls);
+    });
+    long long total = 0;
+    for (long long n : shaded) total += n;
+    return total;
+}
+#endif //__DEFERRED_H__
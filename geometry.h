@@ -4,6 +4,9 @@
 #include <vector>
 #include <cassert>
 #include <iostream>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 template<size_t DimCols,size_t DimRows,typename T> class mat;
 
@@ -20,7 +23,7 @@ private:
 template <typename T> struct vec<2,T> {
     vec() : x(T()), y(T()) {}
     vec(T X, T Y) : x(X), y(Y) {}
-    template <class U> vec<2,T>(const vec<2,U> &v);
+    template <class U> vec(const vec<2,U> &v);
     T& operator[](const size_t i)       { assert(i<2); return i<=0 ? x : y; }
     const T& operator[](const size_t i) const { assert(i<2); return i<=0 ? x : y; }
     float norm() { return std::sqrt(x*x+y*y); }
@@ -33,7 +36,7 @@ template <typename T> struct vec<2,T> {
 template <typename T> struct vec<3,T> {
     vec() : x(T()), y(T()), z(T()) {}
     vec(T X, T Y, T Z) : x(X), y(Y), z(Z) {}
-    template <class U> vec<3,T>(const vec<3,U> &v);
+    template <class U> vec(const vec<3,U> &v);
     T& operator[](const size_t i)       { assert(i<3); return i<=0 ? x : (1==i ? y : z); }
     const T& operator[](const size_t i) const { assert(i<3); return i<=0 ? x : (1==i ? y : z); }
     float norm() { return std::sqrt(x*x+y*y+z*z); }
@@ -44,6 +47,22 @@ template <typename T> struct vec<3,T> {
 
 /////////////////////////////////////////////////////////////////////////////////
 
+// Homogeneous coordinates: one 16-byte aligned SSE register worth of floats, see the overloads below
+template <> struct vec<4,float> {
+    constexpr vec() : data_{} {}
+    constexpr vec(float X, float Y, float Z, float W) : data_{X, Y, Z, W} {}
+    constexpr float& operator[](const size_t i)       { assert(i<4); return data_[i]; }
+    constexpr const float& operator[](const size_t i) const { assert(i<4); return data_[i]; }
+#if defined(__SSE2__)
+    explicit vec(__m128 v) { _mm_store_ps(data_, v); }
+    __m128 simd() const { return _mm_load_ps(data_); }
+#endif
+private:
+    alignas(16) float data_[4];
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+
 template<size_t DIM,typename T> T operator*(const vec<DIM,T>& lhs, const vec<DIM,T>& rhs) {
     T ret = T();
     for (size_t i=DIM; i--; ret+=lhs[i]*rhs[i]);
@@ -210,6 +229,96 @@ template <size_t DimRows,size_t DimCols,class T> std::ostream& operator<<(std::o
     return out;
 }
 
+/////////////////////////////////////////////////////////////////////////////////
+// 4x4 float specializations, same results as the templates above: the SSE versions perform the very same
+// float operations in the same order (sums accumulated from the last index down, starting from +0), so
+// vertex transforms stay bit-identical to VertexCache and to the scalar build.
+// The inverse is closed-form (2x2 sub-determinants) rather than recursive cofactors, its rounding differs.
+
+#if defined(__SSE2__)
+template<> inline mat<4,4,float> mat<4,4,float>::transpose() {
+    __m128 r0 = rows[0].simd(), r1 = rows[1].simd(), r2 = rows[2].simd(), r3 = rows[3].simd();
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    mat<4,4,float> ret;
+    ret[0] = vec<4,float>(r0); ret[1] = vec<4,float>(r1); ret[2] = vec<4,float>(r2); ret[3] = vec<4,float>(r3);
+    return ret;
+}
+
+inline vec<4,float> operator+(const vec<4,float> &lhs, const vec<4,float> &rhs) {
+    return vec<4,float>(_mm_add_ps(lhs.simd(), rhs.simd()));
+}
+
+inline vec<4,float> operator-(const vec<4,float> &lhs, const vec<4,float> &rhs) {
+    return vec<4,float>(_mm_sub_ps(lhs.simd(), rhs.simd()));
+}
+
+inline vec<4,float> operator*(const vec<4,float> &lhs, float rhs) {
+    return vec<4,float>(_mm_mul_ps(lhs.simd(), _mm_set1_ps(rhs)));
+}
+
+inline vec<4,float> operator/(const vec<4,float> &lhs, float rhs) {
+    return vec<4,float>(_mm_div_ps(lhs.simd(), _mm_set1_ps(rhs)));
+}
+
+inline float operator*(const vec<4,float> &lhs, const vec<4,float> &rhs) {
+    vec<4,float> p(_mm_mul_ps(lhs.simd(), rhs.simd()));
+    return 0.f + p[3] + p[2] + p[1] + p[0];
+}
+
+// products of the rows with rhs, transposed so that each register holds one term of the four dot products,
+// then summed from the last term down
+inline vec<4,float> operator*(const mat<4,4,float> &lhs, const vec<4,float> &rhs) {
+    const __m128 v = rhs.simd();
+    __m128 p0 = _mm_mul_ps(lhs[0].simd(), v), p1 = _mm_mul_ps(lhs[1].simd(), v);
+    __m128 p2 = _mm_mul_ps(lhs[2].simd(), v), p3 = _mm_mul_ps(lhs[3].simd(), v);
+    _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+    __m128 acc = _mm_add_ps(_mm_setzero_ps(), p3);
+    acc = _mm_add_ps(acc, p2);
+    acc = _mm_add_ps(acc, p1);
+    return vec<4,float>(_mm_add_ps(acc, p0));
+}
+
+// row i of the product: sum over k=3..0 of rhs row k times lhs[i][k]
+inline mat<4,4,float> operator*(const mat<4,4,float> &lhs, const mat<4,4,float> &rhs) {
+    const __m128 r0 = rhs[0].simd(), r1 = rhs[1].simd(), r2 = rhs[2].simd(), r3 = rhs[3].simd();
+    mat<4,4,float> result;
+    for (size_t i=4; i--; ) {
+        __m128 l = lhs[i].simd();
+        __m128 acc = _mm_add_ps(_mm_setzero_ps(), _mm_mul_ps(r3, _mm_shuffle_ps(l, l, _MM_SHUFFLE(3,3,3,3))));
+        acc = _mm_add_ps(acc, _mm_mul_ps(r2, _mm_shuffle_ps(l, l, _MM_SHUFFLE(2,2,2,2))));
+        acc = _mm_add_ps(acc, _mm_mul_ps(r1, _mm_shuffle_ps(l, l, _MM_SHUFFLE(1,1,1,1))));
+        acc = _mm_add_ps(acc, _mm_mul_ps(r0, _mm_shuffle_ps(l, l, _MM_SHUFFLE(0,0,0,0))));
+        result[i] = vec<4,float>(acc);
+    }
+    return result;
+}
+#endif
+
+template<> inline mat<4,4,float> mat<4,4,float>::invert() {
+    const vec<4,float> *m = rows;
+    float s0 = m[0][0]*m[1][1] - m[1][0]*m[0][1], c5 = m[2][2]*m[3][3] - m[3][2]*m[2][3];
+    float s1 = m[0][0]*m[1][2] - m[1][0]*m[0][2], c4 = m[2][1]*m[3][3] - m[3][1]*m[2][3];
+    float s2 = m[0][0]*m[1][3] - m[1][0]*m[0][3], c3 = m[2][1]*m[3][2] - m[3][1]*m[2][2];
+    float s3 = m[0][1]*m[1][2] - m[1][1]*m[0][2], c2 = m[2][0]*m[3][3] - m[3][0]*m[2][3];
+    float s4 = m[0][1]*m[1][3] - m[1][1]*m[0][3], c1 = m[2][0]*m[3][2] - m[3][0]*m[2][2];
+    float s5 = m[0][2]*m[1][3] - m[1][2]*m[0][3], c0 = m[2][0]*m[3][1] - m[3][0]*m[2][1];
+    float inv = 1.f/(s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0);
+    mat<4,4,float> ret;
+    ret[0] = vec<4,float>( m[1][1]*c5 - m[1][2]*c4 + m[1][3]*c3, -m[0][1]*c5 + m[0][2]*c4 - m[0][3]*c3,
+                           m[3][1]*s5 - m[3][2]*s4 + m[3][3]*s3, -m[2][1]*s5 + m[2][2]*s4 - m[2][3]*s3)*inv;
+    ret[1] = vec<4,float>(-m[1][0]*c5 + m[1][2]*c2 - m[1][3]*c1,  m[0][0]*c5 - m[0][2]*c2 + m[0][3]*c1,
+                          -m[3][0]*s5 + m[3][2]*s2 - m[3][3]*s1,  m[2][0]*s5 - m[2][2]*s2 + m[2][3]*s1)*inv;
+    ret[2] = vec<4,float>( m[1][0]*c4 - m[1][1]*c2 + m[1][3]*c0, -m[0][0]*c4 + m[0][1]*c2 - m[0][3]*c0,
+                           m[3][0]*s4 - m[3][1]*s2 + m[3][3]*s0, -m[2][0]*s4 + m[2][1]*s2 - m[2][3]*s0)*inv;
+    ret[3] = vec<4,float>(-m[1][0]*c3 + m[1][1]*c1 - m[1][2]*c0,  m[0][0]*c3 - m[0][1]*c1 + m[0][2]*c0,
+                          -m[3][0]*s3 + m[3][1]*s1 - m[3][2]*s0,  m[2][0]*s3 - m[2][1]*s1 + m[2][2]*s0)*inv;
+    return ret;
+}
+
+template<> inline mat<4,4,float> mat<4,4,float>::invert_transpose() {
+    return invert().transpose();
+}
+
 /////////////////////////////////////////////////////////////////////////////////
 
 typedef vec<2,  float> Vec2f;
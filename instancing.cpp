@@ -0,0 +1,65 @@
+#include <cmath>
+#include <algorithm>
+#include "instancing.h"
+#include "meshlet.h"
+
+std::vector<int> cull_instances(const RenderContext &ctx, const std::vector<Instance> &instances,
+                                const DrawParams &params, InstanceStats &stats) {
+    const Model &model = *ctx.model;
+    const Vec3f center = (model.bbox_min()+model.bbox_max())*.5f;
+    const float radius = (model.bbox_max()-model.bbox_min()).norm()*.5f;
+    MeshletCuller culler(ctx.Viewport, ctx.Projection*ctx.ModelView, ctx.width(), ctx.height(), Vec3f(),
+                         params.near_w, params.far_z, false); // world space
+    std::vector<int> res;
+    for (int i=0; i<(int)instances.size(); i++) {
+        const Matrix &t = instances[i].transform;
+        float scale = 0;
+        for (int j=0; j<3; j++) scale = std::max(scale, Vec3f(t[0][j], t[1][j], t[2][j]).norm());
+        stats.instances++;
+        if (culler.sphere_visible(proj<3>(t*embed<4>(center)), radius*scale))
+            res.push_back(i);
+        else
+            stats.culled++;
+    }
+    return res;
+}
+
+InstanceStats draw_instanced(RenderContext &ctx, const std::vector<Instance> &instances, VertexCache &clip,
+                             Vec3f light_dir, const DrawParams &params) {
+    InstanceStats stats;
+    std::vector<int> drawn = cull_instances(ctx, instances, params, stats);
+    if (drawn.empty()) return stats;
+
+    const Matrix vp = ctx.Projection*ctx.ModelView;
+    std::vector<Matrix> mvp(drawn.size());
+    std::vector<mat<3,3,float> > normals(drawn.size());
+    for (size_t k=0; k<drawn.size(); k++) {
+        Matrix t = instances[drawn[k]].transform;
+        mvp[k] = vp*t;
+        // normals transform by T^-T; T^-1 applied to the light instead would only be right before renormalizing
+        Matrix it = t.invert_transpose();
+        for (int i=0; i<3; i++)
+            for (int j=0; j<3; j++)
+                normals[k][i][j] = it[i][j];
+    }
+    clip.transform(*ctx.model, mvp, params.nthreads);
+
+    DrawParams p = params;
+    p.copies = (int)drawn.size();
+    if (!ctx.framebuffer.width()) {
+        DepthShader shader;
+        shader.model = ctx.model;
+        shader.clip = &clip;
+        stats.triangles = draw(ctx, shader, p);
+    } else {
+        InstanceShader shader;
+        shader.model = ctx.model;
+        shader.clip = &clip;
+        shader.instances = &instances;
+        shader.drawn = &drawn;
+        shader.normals = &normals;
+        shader.light = light_dir.normalize();
+        stats.triangles = draw(ctx, shader, p);
+    }
+    return stats;
+}
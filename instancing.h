@@ -0,0 +1,54 @@
+#ifndef __INSTANCING_H__
+#define __INSTANCING_H__
+#include <vector>
+#include "our_gl.h"
+
+// One copy of a model in the scene
+struct Instance {
+    Matrix transform = Matrix::identity(); // object to world, followed by ctx.ModelView
+    TGAColor tint = TGAColor(255, 255, 255);
+};
+
+struct InstanceStats {
+    int instances = 0; // submitted
+    int culled = 0;    // bounding sphere entirely outside the view volume
+    DrawStats triangles;
+};
+
+// Indices of the instances of ctx.model whose bounding sphere (the one of its bounding box, scaled by the largest
+// axis scale of the transform) meets the view volume of ctx and the near/far planes of params.
+std::vector<int> cull_instances(const RenderContext &ctx, const std::vector<Instance> &instances,
+                                const DrawParams &params, InstanceStats &stats);
+
+// Gouraud-shaded copies, tinted per instance. clip holds the clip coordinates of every drawn copy, drawn[k] is the
+// instance of copy k and normals[k] the inverse transpose of its transform (3x3), light the unit light direction
+// in world space. The normals are transformed and renormalized at every vertex, so any invertible transform
+// (non-uniform scale, shear) is lit like the transformed mesh.
+struct InstanceShader {
+    static constexpr int nvaryings = 1; // Lambert term
+    const Model *model;
+    const VertexCache *clip;
+    const std::vector<Instance> *instances;
+    const std::vector<int> *drawn;
+    const std::vector<mat<3,3,float> > *normals;
+    Vec3f light;
+    int instance = 0; // copy being drawn, set by draw()
+    mat<1,3,float> varying;
+
+    Vec4f vertex(int iface, int nthvert) {
+        Vec3f n = ((*normals)[instance]*model->normal(iface, nthvert)).normalize();
+        varying[0][nthvert] = std::max(0.f, n*light);
+        return (*clip)[instance*model->nverts() + model->face(iface)[nthvert]];
+    }
+    bool fragment(Vec3f, const vec<1,float> &ity, TGAColor &color) {
+        color = (*instances)[(*drawn)[instance]].tint*ity[0];
+        return false;
+    }
+};
+
+// Draws all the instances of ctx.model in a single draw() call: the copies are culled by bounding sphere first,
+// the vertices of the others transformed in one batch into clip, then their faces (params.faces if given, for
+// every copy) submitted copy after copy. light_dir is in world space. Contexts without color get a depth pass.
+InstanceStats draw_instanced(RenderContext &ctx, const std::vector<Instance> &instances, VertexCache &clip,
+                             Vec3f light_dir, const DrawParams &params=DrawParams());
+#endif //__INSTANCING_H__
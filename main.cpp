@@ -1,87 +1,171 @@
 #include <vector>
+#include <string>
+#include <atomic>
+#include <cstdio>
 #include <cstdlib>
 #include <limits>
+#include <fstream>
+#include <sstream>
 #include <iostream>
 #include "tgaimage.h"
 #include "model.h"
 #include "geometry.h"
 #include "our_gl.h"
-
-Model *model        = NULL;
+#include "ssao.h"
+#include "vertex_cache.h"
+#include "meshlet.h"
+#include "profile.h"
 
 const int width  = 800;
 const int height = 800;
+const int nthreads = 0; // rasterizer threads, 0 = all cores
+const int meshlet_size = 128; // faces per meshlet, culled as a whole before the triangles
 
 Vec3f       eye(0,0,2);
 Vec3f    center(0,0,0);
 Vec3f        up(0,1,0);
 
-struct ZShader : public IShader {
-    mat<4,3,float> varying_tri;
-
-    Vec4f vertex(int iface, int nthvert) override {
-        Vec4f gl_Vertex = Projection*ModelView*embed<4>(model->vert(iface, nthvert));
-        varying_tri.set_col(nthvert, gl_Vertex);
-        return gl_Vertex;
-    }
+struct View {
+    Vec3f eye, center, up;
+    std::string output;
+};
 
-    bool fragment(Vec3f gl_FragCoord, Vec3f bar, TGAColor &color) override {
-        color = TGAColor(0, 0, 0);
+// one camera pose per line: eye.x eye.y eye.z center.x center.y center.z up.x up.y up.z [output.tga]
+// '#' starts a comment; views without an output name are written to framebuffer_<index>.tga
+bool read_views(const char *filename, std::vector<View> &views) {
+    std::ifstream in(filename);
+    if (!in) {
+        std::cerr << "can't open views file " << filename << std::endl;
         return false;
     }
+    std::string line;
+    for (int lineno=1; std::getline(in, line); lineno++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream iss(line);
+        std::string first;
+        if (!(std::istringstream(line) >> first)) continue;
+        View v;
+        for (int i=0; i<3; i++) iss >> v.eye[i];
+        for (int i=0; i<3; i++) iss >> v.center[i];
+        for (int i=0; i<3; i++) iss >> v.up[i];
+        if (iss.fail()) {
+            std::cerr << filename << ":" << lineno << ": expected 9 numbers" << std::endl;
+            return false;
+        }
+        if (!(iss >> v.output)) {
+            char name[32];
+            snprintf(name, sizeof(name), "framebuffer_%04d.tga", (int)views.size());
+            v.output = name;
+        }
+        views.push_back(v);
+    }
+    return true;
+}
+
+struct FrameStats {
+    MeshletStats meshlets;
+    DrawStats triangles;
 };
 
-float max_elevation_angle(float *zbuffer, Vec2f p, Vec2f dir) {
-    float maxangle = 0;
-    for (float t=0.; t<1000.; t+=1.) {
-        Vec2f cur = p + dir*t;
-        if (cur.x>=width || cur.y>=height || cur.x<0 || cur.y<0) return maxangle;
+// renders one view into ctx and writes it out; clip and ao are scratch buffers reused from view to view
+FrameStats render(RenderContext &ctx, VertexCache &clip, std::vector<float> &ao, const View &view, int nthreads) {
+    PROFILE_SCOPE("frame");
+    ctx.clear();
+    lookat(ctx, view.eye, view.center, view.up);
+    viewport(ctx, width/8, height/8, width*3/4, height*3/4);
+    projection(ctx, -1.f/(view.eye-view.center).norm());
 
-        float distance = (p-cur).norm();
-        if (distance < 1.f) continue;
-        float elevation = zbuffer[int(cur.x)+int(cur.y)*width]-zbuffer[int(p.x)+int(p.y)*width];
-        maxangle = std::max(maxangle, atanf(elevation/distance));
+    DrawParams params;
+    params.nthreads = nthreads;
+    params.front_to_back = true;
+    params.cull_backfaces = true;
+    const Matrix mvp = ctx.Projection*ctx.ModelView;
+    FrameStats stats;
+    MeshletCuller culler(ctx.Viewport, mvp, width, height, view.eye, params.near_w, params.far_z, params.cull_backfaces);
+    std::vector<int> faces = culler.faces(ctx.model->meshlets(), ctx.model->meshlet_faces(), stats.meshlets);
+    if (!ctx.model->meshlets().empty()) params.faces = &faces;
+    clip.transform(*ctx.model, mvp, nthreads);
+    stats.triangles = draw_depth(ctx, clip, params);
+
+    const float *zbuffer = ctx.zbuffer.data();
+    SSAOParams ssao_params;
+    ssao_params.nthreads = nthreads;
+    ao.resize(width*height);
+    ssao(zbuffer, width, height, ao.data(), ssao_params);
+    int covered = 0;
+    for (int i=width*height; i--; ) {
+        if (zbuffer[i] < -1e5) continue;
+        float total = pow(ao[i], 100.f);
+        ctx.framebuffer.set(i%width, i/width, TGAColor(total*255, total*255, total*255));
+        covered++;
     }
-    return maxangle;
+    PROFILE_COUNT(PIXELS_COVERED, covered);
+
+    ctx.framebuffer.to_image().write_tga_file(view.output.c_str(), true, true);
+    return stats;
 }
 
+// usage: tiny-renderer [views.txt [frames_in_flight]]
+// Without a views file the default camera is rendered to framebuffer.tga. In batch mode the mesh is loaded once
+// and up to frames_in_flight views (default: one per core) are rendered concurrently, each with its own context.
+// Built with TINY_RENDERER_PROFILE, a timing and counter report is written for the loading and for every frame
+// (for the whole batch when frames are in flight together) to stderr as JSON lines, or to the file named by
+// $TINY_RENDERER_REPORT (CSV if it ends in .csv), and $TINY_RENDERER_TRACE names a Chrome trace-event file.
 int main(int argc, char** argv) {
-    model = new Model("../object/diablo3_pose/diablo3_pose.obj");
-
-//    model = new Model("../object/statue/b_statue.obj");
-    float *zbuffer = new float[width*height];
-
-    for (int i=width*height; i--; zbuffer[i] = -std::numeric_limits<float>::max());
+    std::vector<View> views;
+    if (argc>1) {
+        if (!read_views(argv[1], views)) return 1;
+    } else {
+        views.push_back(View{eye, center, up, "framebuffer.tga"});
+    }
+    const int inflight = std::min(resolve_threads(argc>2 ? atoi(argv[2]) : 0), std::max((int)views.size(), 1));
+    const int frame_threads = std::max(1, resolve_threads(nthreads)/inflight);
 
-    TGAImage frame(width, height, TGAImage::RGB);
-    lookat(eye, center, up);
-    viewport(width/8, height/8, width*3/4, height*3/4);
-    projection(-1.f/(eye-center).norm());
+    std::ofstream report_file;
+    std::ostream *report = &std::cerr;
+    profile::Format format = profile::JSON;
+    const char *report_name = getenv("TINY_RENDERER_REPORT"), *trace_name = getenv("TINY_RENDERER_TRACE");
+    if (profile::enabled && report_name) {
+        report_file.open(report_name);
+        report = &report_file;
+        std::string name(report_name);
+        if (name.size()>4 && name.substr(name.size()-4)==".csv") format = profile::CSV;
+    }
+    if (profile::enabled && trace_name) profile::enable_trace();
 
-    ZShader zshader;
-    for (int i=0; i<model->nfaces(); i++) {
-        for (int j=0; j<3; j++) {
-            zshader.vertex(i, j);
-        }
-        triangle(zshader.varying_tri, zshader, frame, zbuffer);
+    Model *model = new Model("../object/diablo3_pose/diablo3_pose.obj", true, meshlet_size);
+    if (profile::enabled) {
+        profile::report(*report, format, "load", true);
+        profile::reset();
     }
 
-    for (int x=0; x<width; x++) {
-        for (int y=0; y<height; y++) {
-            if (zbuffer[x+y*width] < -1e5) continue;
-            float total = 0;
-            for (float a=0; a<M_PI*2-1e-4; a += M_PI/4) {
-                total += M_PI/2 - max_elevation_angle(zbuffer, Vec2f(x, y), Vec2f(cos(a), sin(a)));
-            }
-            total /= (M_PI/2)*8;
-            total = pow(total, 100.f);
-            frame.set(x, y, TGAColor(total*255, total*255, total*255));
+//    model = new Model("../object/statue/b_statue.obj");
+    std::atomic<int> next(0);
+    parallel_run(inflight, [&](int) {
+        RenderContext ctx(width, height);
+        ctx.model = model;
+        VertexCache clip;
+        std::vector<float> ao;
+        for (int i; (i = next++)<(int)views.size(); ) {
+            if (profile::enabled && inflight==1) profile::reset();
+            FrameStats stats = render(ctx, clip, ao, views[i], frame_threads);
+            if (profile::enabled && inflight==1) profile::report(*report, format, views[i].output);
+            const MeshletStats &m = stats.meshlets;
+            const DrawStats &t = stats.triangles;
+            std::ostringstream msg;
+            msg << "# view " << i << ": " << views[i].output << ", vertex cache: " << clip.size() << " transforms for "
+                << model->nfaces()*3 << " corners" << std::endl
+                << "#   meshlets: " << m.meshlets << " tested, " << m.frustum << " outside the frustum, " << m.backface
+                << " back-facing, " << m.faces_skipped << " of " << model->nfaces() << " faces skipped" << std::endl
+                << "#   triangles: " << t.triangles << " submitted, " << t.frustum << " outside the frustum, " << t.backface
+                << " back faces, " << t.clipped << " clipped, " << t.rasterized << " rasterized" << std::endl;
+            std::cerr << msg.str();
         }
-    }
+    });
+
+    if (profile::enabled && inflight>1) profile::report(*report, format, "batch");
+    if (profile::enabled && trace_name) profile::write_trace(trace_name);
 
-    frame.flip_vertically();
-    frame.write_tga_file("framebuffer.tga");
-    delete [] zbuffer;
     delete model;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,57 @@
+#include <fstream>
+#include "mapped_file.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define HAS_MMAP
+#endif
+
+MappedFile::MappedFile() : data_(NULL), size_(0), map_(NULL), buffer_() {}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const char *filename) {
+    close();
+#ifdef HAS_MMAP
+    int fd = ::open(filename, O_RDONLY);
+    if (fd<0) return false;
+    struct stat st;
+    if (fstat(fd, &st)==0 && st.st_size>0) {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p!=MAP_FAILED) {
+            ::close(fd);
+            map_  = p;
+            data_ = (const char *)p;
+            size_ = st.st_size;
+            return true;
+        }
+    }
+    ::close(fd);
+#endif
+    std::ifstream in(filename, std::ios::binary|std::ios::ate);
+    if (!in.is_open()) return false;
+    buffer_.resize((size_t)in.tellg());
+    in.seekg(0);
+    in.read(buffer_.data(), buffer_.size());
+    if (!in.good() && !buffer_.empty()) {
+        buffer_.clear();
+        return false;
+    }
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef HAS_MMAP
+    if (map_) munmap(map_, size_);
+#endif
+    map_  = NULL;
+    data_ = NULL;
+    size_ = 0;
+    buffer_.clear();
+}
@@ -0,0 +1,22 @@
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+#include <cstddef>
+#include <vector>
+
+// Read-only view of a whole file: memory-mapped where available, read in one go otherwise.
+class MappedFile {
+    const char *data_;
+    size_t size_;
+    void *map_;
+    std::vector<char> buffer_; // fallback storage
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator =(const MappedFile &) = delete;
+    bool open(const char *filename);
+    void close();
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+};
+#endif //__MAPPED_FILE_H__
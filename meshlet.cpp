@@ -0,0 +1,150 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "meshlet.h"
+#include "model.h"
+
+void build_meshlets(const Model &model, int max_faces, std::vector<Meshlet> &meshlets, std::vector<int> &order) {
+    const int nfaces = model.nfaces(), nverts = model.nverts();
+    const int *vidx = model.vert_indices();
+    meshlets.clear();
+    order.clear();
+    order.reserve(nfaces);
+
+    // vertex -> faces, compressed rows
+    std::vector<int> start(nverts+1, 0), vfaces(nfaces*3);
+    for (int i=0; i<nfaces*3; i++) start[vidx[i]+1]++;
+    for (int v=0; v<nverts; v++) start[v+1] += start[v];
+    std::vector<int> fill(start.begin(), start.end()-1);
+    for (int i=0; i<nfaces*3; i++) vfaces[fill[vidx[i]]++] = i/3;
+
+    std::vector<Vec3f> normals(nfaces);
+    for (int f=0; f<nfaces; f++) {
+        Vec3f a = model.vert(f, 0), b = model.vert(f, 1), c = model.vert(f, 2);
+        Vec3f n = cross(b-a, c-a);
+        float len = n.norm();
+        normals[f] = len>0 ? n/len : Vec3f(0, 0, 0);
+    }
+
+    std::vector<int> owner(nfaces, -1), queued(nfaces, -1);
+    std::vector<int> frontier;
+    for (int next=0; ; ) {
+        // seed next to the previous meshlet when possible, so that no isolated islands are left behind
+        int seed = -1;
+        for (int f : frontier)
+            if (owner[f]<0 && (seed<0 || f<seed)) seed = f;
+        while (seed<0 && next<nfaces)
+            if (owner[next++]<0) seed = next-1;
+        if (seed<0) break;
+        const int id = (int)meshlets.size();
+        Meshlet m;
+        m.first = (int)order.size();
+        m.count = 0;
+        Vec3f nsum(0, 0, 0);
+        frontier.assign(1, seed);
+        queued[seed] = id;
+        while (!frontier.empty() && m.count<max_faces) {
+            // take the frontier face closest in orientation to the meshlet so far
+            int best = 0;
+            float best_dp = -2;
+            for (int k=0; k<(int)frontier.size(); k++) {
+                float dp = normals[frontier[k]]*nsum;
+                if (dp>best_dp) {
+                    best_dp = dp;
+                    best = k;
+                }
+            }
+            int f = frontier[best];
+            frontier[best] = frontier.back();
+            frontier.pop_back();
+            owner[f] = id;
+            order.push_back(f);
+            m.count++;
+            nsum = nsum + normals[f];
+            for (int j=0; j<3; j++) {
+                int v = vidx[f*3+j];
+                for (int k=start[v]; k<start[v+1]; k++) {
+                    int g = vfaces[k];
+                    if (owner[g]>=0 || queued[g]==id) continue;
+                    queued[g] = id;
+                    frontier.push_back(g);
+                }
+            }
+        }
+
+        // bounds: sphere around the bounding box center, cone around the mean normal
+        Vec3f lo( std::numeric_limits<float>::max(),  std::numeric_limits<float>::max(),  std::numeric_limits<float>::max());
+        Vec3f hi(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+        for (int i=m.first; i<m.first+m.count; i++)
+            for (int j=0; j<3; j++) {
+                Vec3f p = model.vert(order[i], j);
+                for (int d=0; d<3; d++) {
+                    lo[d] = std::min(lo[d], p[d]);
+                    hi[d] = std::max(hi[d], p[d]);
+                }
+            }
+        m.center = (lo+hi)*.5f;
+        m.radius = 0;
+        float mindp = 1;
+        float len = nsum.norm();
+        m.axis = len>0 ? nsum/len : Vec3f(0, 0, 1);
+        for (int i=m.first; i<m.first+m.count; i++) {
+            for (int j=0; j<3; j++) m.radius = std::max(m.radius, (model.vert(order[i], j)-m.center).norm());
+            mindp = std::min(mindp, normals[order[i]]*m.axis);
+        }
+        m.cutoff = mindp>0 ? std::sqrt(1-mindp*mindp) : 1.f;
+        meshlets.push_back(m);
+    }
+}
+
+MeshletCuller::MeshletCuller(const Matrix &viewport, const Matrix &clip, int width, int height, Vec3f eye,
+                             float near_w, float far_z, bool backfaces) : eye_(eye), backfaces_(backfaces) {
+    // the half-spaces of assemble() pulled back to model space
+    Matrix screen = viewport*clip;
+    Vec4f w = clip[3], unit_w;
+    unit_w[3] = 1;
+    planes_[0] = screen[0];
+    planes_[1] = w*(float)width - screen[0];
+    planes_[2] = screen[1];
+    planes_[3] = w*(float)height - screen[1];
+    planes_[4] = w - unit_w*near_w;
+    planes_[5] = clip[2] - unit_w*std::max(far_z, -1e30f);
+    for (Vec4f &p : planes_) {
+        float len = proj<3>(p).norm();
+        if (len>0) p = p/len;
+    }
+}
+
+bool MeshletCuller::sphere_visible(Vec3f center, float radius) const {
+    for (const Vec4f &p : planes_)
+        if (proj<3>(p)*center + p[3] < -radius) return false;
+    return true;
+}
+
+bool MeshletCuller::backfacing(const Meshlet &m, Vec3f eye) {
+    Vec3f d = m.center-eye;
+    return m.cutoff<1 && d*m.axis >= m.cutoff*d.norm() + m.radius;
+}
+
+bool MeshletCuller::visible(const Meshlet &m, MeshletStats &stats) const {
+    stats.meshlets++;
+    if (!sphere_visible(m.center, m.radius)) {
+        stats.frustum++;
+        stats.faces_skipped += m.count;
+        return false;
+    }
+    if (backfaces_ && backfacing(m, eye_)) {
+        stats.backface++;
+        stats.faces_skipped += m.count;
+        return false;
+    }
+    return true;
+}
+
+std::vector<int> MeshletCuller::faces(const std::vector<Meshlet> &meshlets, const std::vector<int> &order, MeshletStats &stats) const {
+    std::vector<int> res;
+    for (const Meshlet &m : meshlets)
+        if (visible(m, stats))
+            res.insert(res.end(), order.begin()+m.first, order.begin()+m.first+m.count);
+    return res;
+}
@@ -0,0 +1,48 @@
+#ifndef __MESHLET_H__
+#define __MESHLET_H__
+#include <vector>
+#include "geometry.h"
+
+class Model;
+
+// A cluster of neighbouring faces with bounds for coarse culling: a bounding sphere
+// and a cone containing all the face normals (valid only when cutoff<1).
+struct Meshlet {
+    int first, count; // faces order[first, first+count) of the partition
+    Vec3f center;     // bounding sphere
+    float radius;
+    Vec3f axis;       // normal cone: unit axis and the sine of the complement of its half angle,
+    float cutoff;     // 1 when the normals span a half space or more (never back-facing)
+};
+
+// Greedy partition of the faces into meshlets of at most max_faces faces: each meshlet grows from a seed over
+// the faces sharing a vertex with it, always taking the one whose normal is closest to the meshlet average,
+// which keeps the normal cones narrow. order receives the faces meshlet after meshlet.
+void build_meshlets(const Model &model, int max_faces, std::vector<Meshlet> &meshlets, std::vector<int> &order);
+
+struct MeshletStats {
+    int meshlets = 0;  // tested
+    int frustum = 0;   // entirely outside the image or the near/far planes
+    int backface = 0;  // every face turned away from the eye
+    int faces_skipped = 0;
+};
+
+// Whole-meshlet culling for one view. viewport and clip are the matrices of the frame (clip = Projection*ModelView),
+// eye the camera position in model space, near_w and far_z the clip planes of DrawParams.
+class MeshletCuller {
+public:
+    MeshletCuller(const Matrix &viewport, const Matrix &clip, int width, int height, Vec3f eye,
+                  float near_w, float far_z, bool backfaces);
+    bool visible(const Meshlet &m, MeshletStats &stats) const;
+    // true if every face of m is turned away from eye (model space)
+    static bool backfacing(const Meshlet &m, Vec3f eye);
+    // frustum test alone, for any sphere in the space of clip
+    bool sphere_visible(Vec3f center, float radius) const;
+    // the faces of the visible meshlets, in partition order
+    std::vector<int> faces(const std::vector<Meshlet> &meshlets, const std::vector<int> &order, MeshletStats &stats) const;
+private:
+    Vec4f planes_[6]; // model space, normalized: inside when dot(xyz, p) + w >= 0
+    Vec3f eye_;
+    bool backfaces_;
+};
+#endif //__MESHLET_H__
@@ -0,0 +1,51 @@
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include "model.h"
+#include "meshlet.h"
+
+// Partitions a mesh into meshlets and reports how well they bound their faces.
+// usage: meshlets model.obj [max_faces [eye.x eye.y eye.z]]
+// With an eye position, also counts the meshlets and faces a back-facing test from there would skip.
+int main(int argc, char** argv) {
+    if (argc<2) {
+        std::cerr << "usage: " << argv[0] << " model.obj [max_faces [eye.x eye.y eye.z]]" << std::endl;
+        return 1;
+    }
+    const int max_faces = argc>2 ? atoi(argv[2]) : 128;
+    Model model(argv[1], false, max_faces);
+    const std::vector<Meshlet> &meshlets = model.meshlets();
+    if (meshlets.empty()) return 1;
+
+    int cullable = 0, smallest = model.nfaces(), largest = 0;
+    double radius = 0, angle = 0;
+    for (const Meshlet &m : meshlets) {
+        smallest = std::min(smallest, m.count);
+        largest = std::max(largest, m.count);
+        radius += m.radius;
+        if (m.cutoff<1) {
+            cullable++;
+            angle += std::asin(m.cutoff)*180/M_PI;
+        }
+    }
+    Vec3f size = model.bbox_max()-model.bbox_min();
+    std::cout << "faces: " << model.nfaces() << std::endl
+              << "meshlets: " << meshlets.size() << ", " << (double)model.nfaces()/meshlets.size() << " faces on average ("
+              << smallest << " to " << largest << ")" << std::endl
+              << "mean bounding radius: " << radius/meshlets.size() << " (mesh diagonal " << size.norm() << ")" << std::endl
+              << "meshlets with a normal cone: " << cullable << ", mean half angle " << (cullable ? angle/cullable : 0) << " degrees" << std::endl;
+
+    if (argc>5) {
+        Vec3f eye(atof(argv[3]), atof(argv[4]), atof(argv[5]));
+        int skipped = 0, faces = 0;
+        for (const Meshlet &m : meshlets) {
+            if (MeshletCuller::backfacing(m, eye)) {
+                skipped++;
+                faces += m.count;
+            }
+        }
+        std::cout << "back-facing from the eye: " << skipped << " meshlets, " << faces << " faces" << std::endl;
+    }
+    return 0;
+}
@@ -1,107 +1,425 @@
 #include <iostream>
 #include <fstream>
-#include <sstream>
+#include <chrono>
+#include <charconv>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <climits>
+#include <filesystem>
 #include "model.h"
+#include "parallel.h"
+#include "texture_cache.h"
+#include "profile.h"
 
-Model::Model(const char *filename) : verts_(), faces_(), norms_(), uv_(), diffusemap_(), normalmap_(), specularmap_() {
-    std::ifstream in;
-    in.open (filename, std::ifstream::in);
-    if (in.fail()) return;
-    std::string line;
-    while (!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, "v ")) {
-            iss >> trash;
-            Vec3f v;
-            for (int i=0;i<3;i++) iss >> v[i];
-            verts_.push_back(v);
-        } else if (!line.compare(0, 3, "vn ")) {
-            iss >> trash >> trash;
-            Vec3f n;
-            for (int i=0;i<3;i++) iss >> n[i];
-            norms_.push_back(n);
-        } else if (!line.compare(0, 3, "vt ")) {
-            iss >> trash >> trash;
-            Vec2f uv;
-            for (int i=0;i<2;i++) iss >> uv[i];
-            uv_.push_back(uv);
-        }  else if (!line.compare(0, 2, "f ")) {
-            std::vector<Vec3i> f;
-            Vec3i tmp;
-            iss >> trash;
-            while (iss >> tmp[0] >> trash >> tmp[1] >> trash >> tmp[2]) {
-                for (int i=0; i<3; i++) tmp[i]--; // in wavefront obj all indices start at 1, not zero
-                f.push_back(tmp);
+namespace {
+    const size_t OBJ_CHUNK_SIZE = 1<<20;
+
+    const char     MESH_MAGIC[8] = {'T','R','M','E','S','H','\0','\0'};
+    const uint32_t MESH_VERSION  = 1;
+    const uint32_t MESH_ENDIAN   = 0x01020304;
+    const size_t   MESH_ALIGN    = 64;
+    const int      MESH_NARRAYS  = 11;
+
+    // .mesh file: this header, then the arrays vx vy vz nx ny nz u v (floats) and vidx tidx nidx (ints),
+    // each one starting on a MESH_ALIGN boundary. Everything is stored in native byte order.
+    struct MeshHeader {
+        char     magic[8];
+        uint32_t version;
+        uint32_t endian;
+        uint32_t nverts, nnorms, nuv, ntris;
+        uint64_t source_size;  // size and modification time of the .obj the mesh was built from
+        int64_t  source_mtime;
+        float    bbox[6];      // min xyz, max xyz
+    };
+
+    size_t align_up(size_t n) {
+        return (n+MESH_ALIGN-1)/MESH_ALIGN*MESH_ALIGN;
+    }
+
+    // byte offsets of the arrays in a block, returns the size of the block
+    size_t mesh_layout(const MeshHeader &h, size_t offsets[MESH_NARRAYS]) {
+        const size_t nindices = (size_t)h.ntris*3;
+        size_t counts[MESH_NARRAYS] = {h.nverts, h.nverts, h.nverts, h.nnorms, h.nnorms, h.nnorms, h.nuv, h.nuv,
+                                       nindices, nindices, nindices};
+        size_t offset = align_up(sizeof(MeshHeader));
+        for (int i=0; i<MESH_NARRAYS; i++) {
+            offsets[i] = offset;
+            offset = align_up(offset+counts[i]*4);
+        }
+        return offset;
+    }
+
+    // every index of a mapped block within its array, the header having been checked against the file size
+    bool mesh_indices_valid(const char *block) {
+        const MeshHeader &h = *(const MeshHeader *)block;
+        size_t offsets[MESH_NARRAYS];
+        mesh_layout(h, offsets);
+        const uint32_t counts[3] = {h.nverts, h.nuv, h.nnorms};
+        for (int k=0; k<3; k++) {
+            const int *idx = (const int *)(block+offsets[8+k]);
+            for (size_t i=0; i<(size_t)h.ntris*3; i++)
+                if (idx[i]<0 || (uint32_t)idx[i]>=counts[k]) return false;
+        }
+        return true;
+    }
+
+    bool source_stamp(const char *filename, uint64_t &size, int64_t &mtime) {
+        std::error_code ec;
+        size  = std::filesystem::file_size(filename, ec);
+        if (ec) return false;
+        mtime = std::filesystem::last_write_time(filename, ec).time_since_epoch().count();
+        return !ec;
+    }
+
+    // number of elements in one slice of the .obj file, then their offset in the model arrays
+    struct ObjChunk {
+        size_t verts, norms, uv, tris;
+    };
+
+    enum ObjLine { OBJ_OTHER, OBJ_VERTEX, OBJ_NORMAL, OBJ_TEXCOORD, OBJ_FACE };
+
+    const char *skip_blanks(const char *p, const char *end) {
+        while (p<end && (*p==' ' || *p=='\t' || *p=='\r')) p++;
+        return p;
+    }
+
+    template <typename T> bool parse_number(const char *&p, const char *end, T &v) {
+        p = skip_blanks(p, end);
+        if (p<end && *p=='+') p++;
+        std::from_chars_result r = std::from_chars(p, end, v);
+        if (r.ec!=std::errc()) return false;
+        p = r.ptr;
+        return true;
+    }
+
+    // calls fn(type, p, eol) for every line of [p,end), p pointing past the line keyword
+    template <class F> void for_each_line(const char *p, const char *end, F fn) {
+        while (p<end) {
+            const char *eol = (const char *)memchr(p, '\n', end-p);
+            if (!eol) eol = end;
+            size_t len = eol-p;
+            if      (len>=2 && p[0]=='v' && p[1]==' ')                fn(OBJ_VERTEX,   p+2, eol);
+            else if (len>=3 && p[0]=='v' && p[1]=='n' && p[2]==' ')   fn(OBJ_NORMAL,   p+3, eol);
+            else if (len>=3 && p[0]=='v' && p[1]=='t' && p[2]==' ')   fn(OBJ_TEXCOORD, p+3, eol);
+            else if (len>=2 && p[0]=='f' && p[1]==' ')                fn(OBJ_FACE,     p+2, eol);
+            p = eol+1;
+        }
+    }
+
+    // calls fn(k, corner) for the vertex/uv/normal triplets of a face line, returns how many were read
+    template <class F> int parse_face(const char *p, const char *eol, F fn) {
+        int n = 0;
+        Vec3i tmp;
+        while (parse_number(p, eol, tmp[0]) && p<eol && *p++=='/' &&
+               parse_number(p, eol, tmp[1]) && p<eol && *p++=='/' &&
+               parse_number(p, eol, tmp[2])) {
+            for (int i=0; i<3; i++) tmp[i]--; // in wavefront obj all indices start at 1, not zero
+            fn(n++, tmp);
+        }
+        return n;
+    }
+}
+
+// model.obj (or model.mesh) + _diffuse.tga -> model_diffuse.tga
+static std::string texture_path(const char *filename, const char *suffix) {
+    return std::filesystem::path(filename).replace_extension().string() + suffix;
+}
+
+std::string mesh_cache_path(const char *filename) {
+    return std::filesystem::path(filename).replace_extension(".mesh").string();
+}
+
+std::vector<std::string> model_texture_paths(const char *filename) {
+    return {texture_path(filename, "_diffuse.tga"), texture_path(filename, "_nm.tga"), texture_path(filename, "_spec.tga"),
+            texture_path(filename, "_nm_tangent.tga")};
+}
+
+Model::Model(const char *filename, bool cache, int meshlet_size) : nverts_(0), nnorms_(0), nuv_(0), ntris_(0),
+        vx_(NULL), vy_(NULL), vz_(NULL), nx_(NULL), ny_(NULL), nz_(NULL), u_(NULL), v_(NULL),
+        vidx_(NULL), tidx_(NULL), nidx_(NULL), bbox_min_(), bbox_max_(), storage_(), mapping_(),
+        diffuse_(), normal_(), specular_(), meshlets_(), meshlet_faces_() {
+    PROFILE_SCOPE("model_load");
+    if (std::filesystem::path(filename).extension()==".mesh") {
+        if (!load_mesh(filename, NULL)) std::cerr << "can't load mesh " << filename << std::endl;
+    } else if (cache) {
+        std::string mesh = mesh_cache_path(filename);
+        if (!load_mesh(mesh.c_str(), filename)) {
+            load_obj(filename);
+            if (ntris_ && save_mesh(mesh.c_str(), filename)) std::cerr << "# wrote mesh cache " << mesh << std::endl;
+        }
+    } else {
+        load_obj(filename);
+    }
+    std::cerr << "# v# " << nverts_ << " f# "  << ntris_ << " vt# " << nuv_ << " vn# " << nnorms_ << std::endl;
+    std::vector<std::string> textures = model_texture_paths(filename);
+    diffuse_.path  = textures[0];
+    normal_.path   = textures[1];
+    specular_.path = textures[2];
+    if (meshlet_size>0) {
+        build_meshlets(*this, meshlet_size, meshlets_, meshlet_faces_);
+        std::cerr << "# " << meshlets_.size() << " meshlets of at most " << meshlet_size << " faces" << std::endl;
+    }
+}
+
+void Model::bind(const char *block) {
+    const MeshHeader &h = *(const MeshHeader *)block;
+    size_t offsets[MESH_NARRAYS];
+    mesh_layout(h, offsets);
+    nverts_ = h.nverts; nnorms_ = h.nnorms; nuv_ = h.nuv; ntris_ = h.ntris;
+    const float **floats[8] = {&vx_, &vy_, &vz_, &nx_, &ny_, &nz_, &u_, &v_};
+    for (int i=0; i<8; i++) *floats[i] = (const float *)(block+offsets[i]);
+    const int **ints[3] = {&vidx_, &tidx_, &nidx_};
+    for (int i=0; i<3; i++) *ints[i] = (const int *)(block+offsets[8+i]);
+    bbox_min_ = Vec3f(h.bbox[0], h.bbox[1], h.bbox[2]);
+    bbox_max_ = Vec3f(h.bbox[3], h.bbox[4], h.bbox[5]);
+}
+
+// The file is mapped and cut at line boundaries into OBJ_CHUNK_SIZE slices. A first parallel pass counts
+// the elements of every slice, a second one parses the slices straight into their place in the block,
+// polygons being fanned into triangles. Face indices are absolute, so the slices are independent.
+void Model::load_obj(const char *filename) {
+    auto start = std::chrono::steady_clock::now();
+    MappedFile file;
+    if (!file.open(filename)) return;
+    const char *data = file.data(), *end = data+file.size();
+
+    std::vector<const char *> cuts(1, data);
+    while (cuts.back()<end) {
+        const char *cut = cuts.back()+std::min(OBJ_CHUNK_SIZE, (size_t)(end-cuts.back()));
+        const char *eol = cut<end ? (const char *)memchr(cut, '\n', end-cut) : NULL;
+        cuts.push_back(eol ? eol+1 : end);
+    }
+    const int nchunks = cuts.size()-1;
+    std::vector<ObjChunk> chunks(nchunks+1, ObjChunk{0, 0, 0, 0});
+    parallel_for(nchunks, 0, [&](int i) {
+        ObjChunk &c = chunks[i+1];
+        for_each_line(cuts[i], cuts[i+1], [&](ObjLine type, const char *p, const char *eol) {
+            switch (type) {
+                case OBJ_VERTEX:   c.verts++; break;
+                case OBJ_NORMAL:   c.norms++; break;
+                case OBJ_TEXCOORD: c.uv++;    break;
+                case OBJ_FACE:     c.tris += std::max(parse_face(p, eol, [](int, const Vec3i &) {})-2, 0); break;
+                default: break;
+            }
+        });
+    });
+    for (int i=1; i<=nchunks; i++) { // prefix sums: chunks[i] becomes the offset of slice i
+        chunks[i].verts += chunks[i-1].verts; chunks[i].norms += chunks[i-1].norms;
+        chunks[i].uv    += chunks[i-1].uv;    chunks[i].tris  += chunks[i-1].tris;
+    }
+
+    MeshHeader h;
+    memset((void *)&h, 0, sizeof(h));
+    memcpy(h.magic, MESH_MAGIC, sizeof(h.magic));
+    h.version = MESH_VERSION;
+    h.endian  = MESH_ENDIAN;
+    h.nverts  = chunks[nchunks].verts; h.nnorms = chunks[nchunks].norms;
+    h.nuv     = chunks[nchunks].uv;    h.ntris  = chunks[nchunks].tris;
+    size_t offsets[MESH_NARRAYS];
+    storage_.assign(mesh_layout(h, offsets), 0);
+    char *block = storage_.data();
+    float *vx = (float *)(block+offsets[0]), *vy = (float *)(block+offsets[1]), *vz = (float *)(block+offsets[2]);
+    float *nx = (float *)(block+offsets[3]), *ny = (float *)(block+offsets[4]), *nz = (float *)(block+offsets[5]);
+    float *u  = (float *)(block+offsets[6]), *v  = (float *)(block+offsets[7]);
+    int *vidx = (int *)(block+offsets[8]), *tidx = (int *)(block+offsets[9]), *nidx = (int *)(block+offsets[10]);
+
+    parallel_for(nchunks, 0, [&](int i) {
+        ObjChunk c = chunks[i];
+        for_each_line(cuts[i], cuts[i+1], [&](ObjLine type, const char *p, const char *eol) {
+            Vec3f val;
+            if (type==OBJ_VERTEX) {
+                for (int k=0; k<3 && parse_number(p, eol, val[k]); k++);
+                vx[c.verts] = val.x; vy[c.verts] = val.y; vz[c.verts] = val.z;
+                c.verts++;
+            } else if (type==OBJ_NORMAL) {
+                for (int k=0; k<3 && parse_number(p, eol, val[k]); k++);
+                val.normalize();
+                nx[c.norms] = val.x; ny[c.norms] = val.y; nz[c.norms] = val.z;
+                c.norms++;
+            } else if (type==OBJ_TEXCOORD) {
+                for (int k=0; k<2 && parse_number(p, eol, val[k]); k++);
+                u[c.uv] = val.x; v[c.uv] = val.y;
+                c.uv++;
+            } else if (type==OBJ_FACE) {
+                Vec3i first, prev;
+                parse_face(p, eol, [&](int k, const Vec3i &corner) { // fan triangulation
+                    if (k>=2) {
+                        size_t t = 3*c.tris++;
+                        for (const Vec3i &tc : {first, prev, corner}) {
+                            vidx[t] = tc[0]; tidx[t] = tc[1]; nidx[t] = tc[2];
+                            t++;
+                        }
+                    }
+                    if (k==0) first = corner;
+                    prev = corner;
+                });
             }
-            faces_.push_back(f);
+        });
+    });
+    file.close();
+
+    for (int k=0; k<3; k++) {
+        const float *axis = (const float *)(block+offsets[k]);
+        h.bbox[k]   =  std::numeric_limits<float>::max();
+        h.bbox[k+3] = -std::numeric_limits<float>::max();
+        for (size_t i=0; i<h.nverts; i++) {
+            h.bbox[k]   = std::min(h.bbox[k],   axis[i]);
+            h.bbox[k+3] = std::max(h.bbox[k+3], axis[i]);
         }
     }
-    std::cerr << "# v# " << verts_.size() << " f# "  << faces_.size() << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;
-//    load_texture(filename, "_diffuse.tga", diffusemap_);
-//    load_texture(filename, "_nm.tga",      normalmap_);
-//    load_texture(filename, "_spec.tga",    specularmap_);
+    memcpy(block, &h, sizeof(h));
+    bind(block);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    std::cerr << "# " << filename << ": " << (end-data)/1e6 << " MB in " << seconds*1e3 << " ms, " << (end-data)/1e6/seconds << " MB/s" << std::endl;
+}
+
+// The block is used straight from the mapping once its header and indices are checked against the file.
+// With a source, the mesh is only accepted if it was built from a file of the same size and modification time.
+bool Model::load_mesh(const char *filename, const char *source) {
+    auto start = std::chrono::steady_clock::now();
+    if (!mapping_.open(filename)) return false;
+    const MeshHeader *h = (const MeshHeader *)mapping_.data();
+    size_t offsets[MESH_NARRAYS];
+    bool valid = mapping_.size()>=sizeof(MeshHeader) && !memcmp(h->magic, MESH_MAGIC, sizeof(h->magic)) &&
+                 h->version==MESH_VERSION && h->endian==MESH_ENDIAN &&
+                 h->nverts<=INT_MAX && h->nnorms<=INT_MAX && h->nuv<=INT_MAX && h->ntris<=INT_MAX/3 &&
+                 mesh_layout(*h, offsets)<=mapping_.size();
+    if (valid && source) {
+        uint64_t size;
+        int64_t mtime;
+        valid = source_stamp(source, size, mtime) && size==h->source_size && mtime==h->source_mtime;
+    }
+    if (valid && !mesh_indices_valid(mapping_.data())) {
+        std::cerr << "corrupt mesh file " << filename << ": index out of range" << std::endl;
+        valid = false;
+    }
+    if (!valid) {
+        mapping_.close();
+        return false;
+    }
+    bind(mapping_.data());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    std::cerr << "# " << filename << ": " << mapping_.size()/1e6 << " MB mapped in " << seconds*1e3 << " ms" << std::endl;
+    return true;
+}
+
+// Writes the block (header and arrays) to a temporary file renamed at the end, so a concurrent
+// reader never maps a partial mesh.
+bool Model::save_mesh(const char *filename, const char *source) {
+    const char *block = storage_.empty() ? mapping_.data() : storage_.data();
+    if (!block) return false;
+    MeshHeader h = *(const MeshHeader *)block;
+    h.source_size  = 0;
+    h.source_mtime = 0;
+    if (source && !source_stamp(source, h.source_size, h.source_mtime)) {
+        std::cerr << "can't stat " << source << std::endl;
+        return false;
+    }
+    size_t offsets[MESH_NARRAYS];
+    size_t size = mesh_layout(h, offsets);
+    std::string tmp = std::string(filename) + ".tmp";
+    std::ofstream out(tmp.c_str(), std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << tmp << std::endl;
+        return false;
+    }
+    out.write((const char *)&h, sizeof(h));
+    out.write(block+sizeof(h), size-sizeof(h));
+    out.close();
+    std::error_code ec;
+    if (!out.good() || (std::filesystem::rename(tmp, filename, ec), ec)) {
+        std::cerr << "can't write the mesh file " << filename << std::endl;
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
 }
 
 Model::~Model() {}
 
-int Model::nverts() {
-    return (int)verts_.size();
+int Model::nverts() const {
+    return nverts_;
 }
 
-int Model::nfaces() {
-    return (int)faces_.size();
+int Model::nfaces() const {
+    return ntris_;
 }
 
-std::vector<int> Model::face(int idx) {
-    std::vector<int> face;
-    for (int i=0; i<(int)faces_[idx].size(); i++) face.push_back(faces_[idx][i][0]);
-    return face;
+std::span<const int> Model::face(int idx) const {
+    return std::span<const int>(vidx_+idx*3, 3);
 }
 
-Vec3f Model::vert(int i) {
-    return verts_[i];
+Vec3f Model::vert(int i) const {
+    return Vec3f(vx_[i], vy_[i], vz_[i]);
 }
 
-Vec3f Model::vert(int iface, int nthvert) {
-    return verts_[faces_[iface][nthvert][0]];
+Vec3f Model::vert(int iface, int nthvert) const {
+    return vert(vidx_[iface*3+nthvert]);
 }
 
-void Model::load_texture(std::string filename, const char *suffix, TGAImage &img) {
-    std::string texfile(filename);
-    size_t dot = texfile.find_last_of(".");
-    if (dot!=std::string::npos) {
-        texfile = texfile.substr(0,dot) + std::string(suffix);
-        std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
-        img.flip_vertically();
-    }
+// the lookups run per fragment: after the first call this is a flag check, no cache lock nor refcount
+const Texture &Model::LazyMap::get() const {
+    std::call_once(once, [this]() { texture = TextureCache::instance().acquire(path); });
+    return *texture;
+}
+
+std::shared_ptr<const Texture> Model::diffusemap() const {
+    diffuse_.get();
+    return diffuse_.texture;
+}
+
+std::shared_ptr<const Texture> Model::normalmap() const {
+    normal_.get();
+    return normal_.texture;
+}
+
+std::shared_ptr<const Texture> Model::specularmap() const {
+    specular_.get();
+    return specular_.texture;
+}
+
+TGAColor Model::diffuse(Vec2f uvf) const {
+    return diffuse_.get().sample(uvf);
 }
 
-TGAColor Model::diffuse(Vec2f uvf) {
-    Vec2i uv(uvf[0]*diffusemap_.get_width(), uvf[1]*diffusemap_.get_height());
-    return diffusemap_.get(uv[0], uv[1]);
+TGAColor Model::diffuse(Vec2f uvf, Vec2f duvdx, Vec2f duvdy, TextureFilter filter) const {
+    const Texture &tex = diffuse_.get();
+    return tex.sample(uvf, tex.lod(duvdx, duvdy), filter);
 }
 
-Vec3f Model::normal(Vec2f uvf) {
-    Vec2i uv(uvf[0]*normalmap_.get_width(), uvf[1]*normalmap_.get_height());
-    TGAColor c = normalmap_.get(uv[0], uv[1]);
+static Vec3f decode_normal(TGAColor c) {
     Vec3f res;
     for (int i=0; i<3; i++)
         res[2-i] = (float)c[i]/255.f*2.f - 1.f;
     return res;
 }
 
-Vec2f Model::uv(int iface, int nthvert) {
-    return uv_[faces_[iface][nthvert][1]];
+Vec3f Model::normal(Vec2f uvf) const {
+    return decode_normal(normal_.get().sample(uvf));
+}
+
+Vec3f Model::normal(Vec2f uvf, Vec2f duvdx, Vec2f duvdy, TextureFilter filter) const {
+    const Texture &tex = normal_.get();
+    return decode_normal(tex.sample(uvf, tex.lod(duvdx, duvdy), filter));
+}
+
+Vec2f Model::uv(int iface, int nthvert) const {
+    int idx = tidx_[iface*3+nthvert];
+    return Vec2f(u_[idx], v_[idx]);
+}
+
+float Model::specular(Vec2f uvf) const {
+    return specular_.get().sample(uvf)[0]/1.f;
 }
 
-float Model::specular(Vec2f uvf) {
-    Vec2i uv(uvf[0]*specularmap_.get_width(), uvf[1]*specularmap_.get_height());
-    return specularmap_.get(uv[0], uv[1])[0]/1.f;
+float Model::specular(Vec2f uvf, Vec2f duvdx, Vec2f duvdy, TextureFilter filter) const {
+    const Texture &tex = specular_.get();
+    return tex.sample(uvf, tex.lod(duvdx, duvdy), filter)[0]/1.f;
 }
 
-Vec3f Model::normal(int iface, int nthvert) {
-    int idx = faces_[iface][nthvert][2];
-    return norms_[idx].normalize();
+Vec3f Model::normal(int iface, int nthvert) const {
+    int idx = nidx_[iface*3+nthvert];
+    return Vec3f(nx_[idx], ny_[idx], nz_[idx]);
 }
\ No newline at end of file
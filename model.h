@@ -1,32 +1,84 @@
 #ifndef __MODEL_H__
 #define __MODEL_H__
+#include <span>
+#include <mutex>
+#include <memory>
 #include <vector>
 #include <string>
 #include "geometry.h"
 #include "tgaimage.h"
+#include "texture.h"
+#include "mapped_file.h"
+#include "meshlet.h"
 
+// Triangle mesh in flat arrays: polygons are fanned into triangles at load time, the vertex attributes
+// are stored as separate x/y/z (u/v) arrays and every triangle has 3 entries in each index buffer.
+// The arrays live in one block laid out like a .mesh file (see save_mesh()), so a .mesh file is mapped
+// and used in place.
 class Model {
 private:
-    std::vector<Vec3f> verts_;
-    std::vector<std::vector<Vec3i> > faces_; // attention, this Vec3i means vertex/uv/normal
-    std::vector<Vec3f> norms_;
-    std::vector<Vec2f> uv_;
-    TGAImage diffusemap_;
-    TGAImage normalmap_;
-    TGAImage specularmap_;
-    void load_texture(std::string filename, const char *suffix, TGAImage &img);
+    int nverts_, nnorms_, nuv_, ntris_;
+    const float *vx_, *vy_, *vz_; // positions
+    const float *nx_, *ny_, *nz_; // normals, normalized at load time
+    const float *u_, *v_;         // texture coordinates
+    const int *vidx_, *tidx_, *nidx_; // position/uv/normal index of the 3 corners of each triangle
+    Vec3f bbox_min_, bbox_max_;
+    std::vector<char> storage_; // the block when parsed from an .obj
+    MappedFile mapping_;        // the block when read from a .mesh
+    // a texture next to the mesh, acquired from TextureCache on first use and then held by the model
+    struct LazyMap {
+        std::string path;
+        mutable std::once_flag once;
+        mutable std::shared_ptr<const Texture> texture;
+        const Texture &get() const;
+    };
+    LazyMap diffuse_, normal_, specular_;
+    std::vector<Meshlet> meshlets_;
+    std::vector<int> meshlet_faces_; // faces meshlet after meshlet
+    void load_obj(const char *filename);
+    bool load_mesh(const char *filename, const char *source);
+    void bind(const char *block);
 public:
-    Model(const char *filename);
+    // Loads an .obj or a .mesh file. With cache set, an .obj is read through the <name>.mesh file next
+    // to it, which is (re)written whenever it is missing or older than the .obj.
+    // A positive meshlet_size partitions the faces into meshlets of at most that many faces (see build_meshlets()).
+    // The meshlets are rebuilt on every load, the .mesh cache does not store them.
+    Model(const char *filename, bool cache=false, int meshlet_size=0);
     ~Model();
-    int nverts();
-    int nfaces();
-    Vec3f normal(int iface, int nthvert);
-    Vec3f normal(Vec2f uv);
-    Vec3f vert(int i);
-    Vec3f vert(int iface, int nthvert);
-    Vec2f uv(int iface, int nthvert);
-    TGAColor diffuse(Vec2f uv);
-    float specular(Vec2f uv);
-    std::vector<int> face(int idx);
+    Model(const Model &) = delete;
+    Model & operator =(const Model &) = delete;
+    bool save_mesh(const char *filename, const char *source=NULL); // source: .obj the cache is checked against
+    int nverts() const;
+    int nfaces() const; // triangles
+    Vec3f normal(int iface, int nthvert) const;
+    Vec3f normal(Vec2f uv) const;
+    Vec3f vert(int i) const;
+    Vec3f vert(int iface, int nthvert) const;
+    Vec2f uv(int iface, int nthvert) const;
+    TGAColor diffuse(Vec2f uv) const;
+    float specular(Vec2f uv) const;
+    // filtered lookups, the mip level being picked from the screen-space derivatives of uv (see uv_derivatives())
+    Vec3f normal(Vec2f uv, Vec2f duvdx, Vec2f duvdy, TextureFilter filter=TRILINEAR) const;
+    TGAColor diffuse(Vec2f uv, Vec2f duvdx, Vec2f duvdy, TextureFilter filter=TRILINEAR) const;
+    float specular(Vec2f uv, Vec2f duvdx, Vec2f duvdy, TextureFilter filter=TRILINEAR) const;
+    // the maps themselves, kept alive by the model whatever the cache evicts
+    std::shared_ptr<const Texture> diffusemap() const;
+    std::shared_ptr<const Texture> normalmap() const;
+    std::shared_ptr<const Texture> specularmap() const;
+    std::span<const int> face(int idx) const; // position indices of the triangle
+    const std::vector<Meshlet> &meshlets() const { return meshlets_; }
+    const std::vector<int> &meshlet_faces() const { return meshlet_faces_; } // Meshlet::first/count index this
+    Vec3f bbox_min() const { return bbox_min_; }
+    Vec3f bbox_max() const { return bbox_max_; }
+
+    // raw arrays for batched processing, nverts() floats per axis and 3*nfaces() indices
+    const float *positions(int axis) const { return axis==0 ? vx_ : (axis==1 ? vy_ : vz_); }
+    const int *vert_indices() const { return vidx_; }
 };
-#endif //__MODEL_H__
\ No newline at end of file
+
+// .obj path -> path of its binary cache
+std::string mesh_cache_path(const char *filename);
+// .obj (or .mesh) path -> paths of the diffuse, normal and specular maps Model looks for next to it,
+// then of the tangent-space normal map, which Model does not sample itself
+std::vector<std::string> model_texture_paths(const char *filename);
+#endif //__MODEL_H__
@@ -0,0 +1,21 @@
+#include <iostream>
+#include <string>
+#include "model.h"
+
+// Converts an .obj file into the binary .mesh format Model maps in place.
+// The mesh is stamped with the .obj size and modification time, so Model(filename, true) accepts it as cache.
+int main(int argc, char** argv) {
+    if (argc<2) {
+        std::cerr << "usage: " << argv[0] << " model.obj [model.mesh]" << std::endl;
+        return 1;
+    }
+    Model model(argv[1]);
+    if (!model.nfaces()) {
+        std::cerr << "no triangles in " << argv[1] << std::endl;
+        return 1;
+    }
+    std::string out = argc>2 ? argv[2] : mesh_cache_path(argv[1]);
+    if (!model.save_mesh(out.c_str(), argv[1])) return 1;
+    std::cerr << "wrote " << out << std::endl;
+    return 0;
+}
@@ -3,13 +3,35 @@
 #include <cstdlib>
 #include "our_gl.h"
 
-Matrix ModelView;
-Matrix Viewport;
-Matrix Projection;
-
 IShader::~IShader() {}
 
-void viewport(int x, int y, int w, int h) {
+RenderContext::RenderContext(int width, int height, bool color, DepthFormat format) : ModelView(Matrix::identity()),
+        Projection(Matrix::identity()), Viewport(Matrix::identity()), framebuffer(color ? width : 0, color ? height : 0),
+        depth_format(format), zbuffer(format==DEPTH32F ? width*height : 0), zbuffer16(format==DEPTH16 ? width*height : 0),
+        depth_min(0), depth_scale(1), depth_test(DEPTH_GEQUAL), hiz(width, height), model(NULL) {
+    set_depth_range(-1, 1);
+    clear();
+}
+
+void RenderContext::set_depth_range(float zmin, float zmax) {
+    depth_min = zmin;
+    depth_scale = 65535.f/(zmax-zmin);
+}
+
+float RenderContext::depth(int x, int y) const {
+    if (depth_format==DEPTH32F) return zbuffer[x+y*width()];
+    return depth_min + zbuffer16[x+y*width()]/depth_scale;
+}
+
+void RenderContext::clear() {
+    framebuffer.clear();
+    std::fill(zbuffer.begin(), zbuffer.end(), -std::numeric_limits<float>::max());
+    std::fill(zbuffer16.begin(), zbuffer16.end(), 0);
+    hiz.clear();
+}
+
+void viewport(RenderContext &ctx, int x, int y, int w, int h) {
+    Matrix &Viewport = ctx.Viewport;
     Viewport = Matrix::identity();
     Viewport[0][3] = x+w/2.f;
     Viewport[1][3] = y+h/2.f;
@@ -19,12 +41,12 @@ void viewport(int x, int y, int w, int h) {
     Viewport[2][2] = 0;
 }
 
-void projection(float coeff) {
-    Projection = Matrix::identity();
-    Projection[3][2] = coeff;
+void projection(RenderContext &ctx, float coeff) {
+    ctx.Projection = Matrix::identity();
+    ctx.Projection[3][2] = coeff;
 }
 
-void lookat(Vec3f eye, Vec3f center, Vec3f up) {
+void lookat(RenderContext &ctx, Vec3f eye, Vec3f center, Vec3f up) {
     Vec3f z = (eye-center).normalize();
     Vec3f x = cross(up,z).normalize();
     Vec3f y = cross(z,x).normalize();
@@ -36,7 +58,74 @@ void lookat(Vec3f eye, Vec3f center, Vec3f up) {
         Minv[2][i] = z[i];
         Tr[i][3] = -center[i];
     }
-    ModelView = Minv*Tr;
+    ctx.ModelView = Minv*Tr;
+}
+
+HiZ::HiZ(int w, int h) : width(w), height(h),
+        ntx((w+BLOCK_SIZE-1)/BLOCK_SIZE), nty((h+BLOCK_SIZE-1)/BLOCK_SIZE),
+        ncx((w+TILE_SIZE-1)/TILE_SIZE),   ncy((h+TILE_SIZE-1)/TILE_SIZE),
+        tiles(ntx*nty), coarse(ncx*ncy) {
+    clear();
+}
+
+void HiZ::clear() {
+    std::fill(tiles.begin(),  tiles.end(),  -std::numeric_limits<float>::max());
+    std::fill(coarse.begin(), coarse.end(), -std::numeric_limits<float>::max());
+}
+
+bool HiZ::update_tile(const float *zbuffer, int tx, int ty) {
+    int x0 = tx*BLOCK_SIZE, x1 = std::min(x0+BLOCK_SIZE, width);
+    int y0 = ty*BLOCK_SIZE, y1 = std::min(y0+BLOCK_SIZE, height);
+    vfloat vz(std::numeric_limits<float>::max());
+    float zmin = std::numeric_limits<float>::max();
+    for (int y=y0; y<y1; y++) {
+        const float *row = zbuffer+y*width;
+        int x = x0;
+        for (; x+vfloat::N<=x1; x+=vfloat::N) vz = vmin(vz, vfloat::load(row+x));
+        for (; x<x1; x++) zmin = std::min(zmin, row[x]);
+    }
+    float lanes[vfloat::N];
+    vz.store(lanes);
+    for (int i=0; i<vfloat::N; i++) zmin = std::min(zmin, lanes[i]);
+    float &tile = tiles[tx+ty*ntx];
+    if (zmin<=tile) return false;
+    tile = zmin;
+    return true;
+}
+
+bool HiZ::update_tile(const uint16_t *zbuffer, float zmin, float scale, int tx, int ty) {
+    int x0 = tx*BLOCK_SIZE, x1 = std::min(x0+BLOCK_SIZE, width);
+    int y0 = ty*BLOCK_SIZE, y1 = std::min(y0+BLOCK_SIZE, height);
+    int qmin = 65535;
+    for (int y=y0; y<y1; y++)
+        for (int x=x0; x<x1; x++)
+            qmin = std::min(qmin, (int)zbuffer[x+y*width]);
+    // half a step below: any depth that rounds to qmin or above is not farther than this
+    float z = zmin + (qmin-.5f)/scale;
+    float &tile = tiles[tx+ty*ntx];
+    if (z<=tile) return false;
+    tile = z;
+    return true;
+}
+
+void HiZ::update_coarse(int cx, int cy) {
+    const int n = TILE_SIZE/BLOCK_SIZE;
+    float zmin = std::numeric_limits<float>::max();
+    for (int ty=cy*n; ty<std::min((cy+1)*n, nty); ty++)
+        for (int tx=cx*n; tx<std::min((cx+1)*n, ntx); tx++)
+            zmin = std::min(zmin, tiles[tx+ty*ntx]);
+    coarse[cx+cy*ncx] = zmin;
+}
+
+float closest_depth(mat<4,3,float> &pts) {
+    float zmax = -std::numeric_limits<float>::max();
+    for (int i=0; i<3; i++) {
+        if (!(pts[3][i]>0)) return std::numeric_limits<float>::max();
+        zmax = std::max(zmax, pts[2][i]);
+    }
+    // with positive w the interpolated depth is a convex combination of the vertex depths,
+    // up to the rounding of the barycentric coordinates
+    return zmax + std::abs(zmax)*1e-5f;
 }
 
 Vec3f barycentric(Vec2f A, Vec2f B, Vec2f C, Vec2f P) {
@@ -52,34 +141,102 @@ Vec3f barycentric(Vec2f A, Vec2f B, Vec2f C, Vec2f P) {
     return Vec3f(-1,1,1); // in this case generate negative coordinates, it will be thrown away by the rasterizator
 }
 
-void triangle(mat<4,3,float> &clipc, IShader &shader, TGAImage &image, float *zbuffer) {
-    mat<3,4,float> pts  = (Viewport*clipc).transpose(); // transposed to ease access to each of the points
-    mat<3,2,float> pts2;
-    for (int i=0; i<3; i++) pts2[i] = proj<2>(pts[i]/pts[i][3]);
-
+bool screen_bbox(const Matrix &viewport, mat<4,3,float> &clipc, int width, int height, int bbox[4]) {
+    mat<3,4,float> pts = (viewport*clipc).transpose();
     Vec2f bboxmin( std::numeric_limits<float>::max(),  std::numeric_limits<float>::max());
     Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
-    Vec2f clamp(image.get_width()-1, image.get_height()-1);
+    Vec2f clamp(width-1, height-1);
     for (int i=0; i<3; i++) {
+        Vec2f p = proj<2>(pts[i]/pts[i][3]);
         for (int j=0; j<2; j++) {
-            bboxmin[j] = std::max(0.f,      std::min(bboxmin[j], pts2[i][j]));
-            bboxmax[j] = std::min(clamp[j], std::max(bboxmax[j], pts2[i][j]));
+            bboxmin[j] = std::max(0.f,      std::min(bboxmin[j], p[j]));
+            bboxmax[j] = std::min(clamp[j], std::max(bboxmax[j], p[j]));
         }
     }
-    Vec2i P;
-    TGAColor color;
-    for (P.x=bboxmin.x; P.x<=bboxmax.x; P.x++) {
-        for (P.y=bboxmin.y; P.y<=bboxmax.y; P.y++) {
-            Vec3f bc_screen  = barycentric(pts2[0], pts2[1], pts2[2], P);
-            Vec3f bc_clip    = Vec3f(bc_screen.x/pts[0][3], bc_screen.y/pts[1][3], bc_screen.z/pts[2][3]);
-            bc_clip = bc_clip/(bc_clip.x+bc_clip.y+bc_clip.z);
-            float frag_depth = clipc[2]*bc_clip;
-            if (bc_screen.x<0 || bc_screen.y<0 || bc_screen.z<0 || zbuffer[P.x+P.y*image.get_width()]>frag_depth) continue;
-            bool discard = shader.fragment(Vec3f(P.x, P.y, frag_depth), bc_clip, color);
-            if (!discard) {
-                zbuffer[P.x+P.y*image.get_width()] = frag_depth;
-                image.set(P.x, P.y, color);
-            }
+    if (!(bboxmin.x<=bboxmax.x && bboxmin.y<=bboxmax.y)) return false; // off-screen (or NaN) triangle
+    bbox[0] = bboxmin.x; bbox[1] = bboxmin.y;
+    bbox[2] = bboxmax.x; bbox[3] = bboxmax.y;
+    return true;
+}
+
+// Sutherland-Hodgman against the plane v[axis] >= d
+static void clip_polygon(ClippedPolygon &poly, int axis, float d) {
+    ClippedPolygon out;
+    out.n = 0;
+    for (int i=0; i<poly.n; i++) {
+        int j = (i+1)%poly.n;
+        float di = poly.v[i][axis]-d, dj = poly.v[j][axis]-d;
+        if (di>=0) {
+            out.v[out.n] = poly.v[i];
+            out.bar[out.n++] = poly.bar[i];
+        }
+        if ((di>=0)!=(dj>=0)) {
+            float t = di/(di-dj);
+            out.v[out.n] = poly.v[i] + (poly.v[j]-poly.v[i])*t;
+            out.bar[out.n++] = poly.bar[i] + (poly.bar[j]-poly.bar[i])*t;
         }
     }
-}
\ No newline at end of file
+    poly = out;
+}
+
+int assemble(const Matrix &viewport, int width, int height, const DrawParams &params, mat<4,3,float> &clipc,
+             ClippedPolygon &poly, DrawStats &stats) {
+    // outcodes: screen borders as homogeneous half-spaces of viewport*clipc, then near and far
+    mat<4,3,float> h = viewport*clipc;
+    int all = ~0, any = 0;
+    for (int i=0; i<3; i++) {
+        float w = clipc[3][i];
+        int code = (h[0][i]<0)          | (h[0][i]>width*w)<<1
+                 | (h[1][i]<0)<<2       | (h[1][i]>height*w)<<3
+                 | !(w>=params.near_w)<<4 | (clipc[2][i]<params.far_z)<<5;
+        all &= code;
+        any |= code;
+    }
+    if (all) {
+        stats.frustum++;
+        return 0;
+    }
+    poly.n = 3;
+    for (int i=0; i<3; i++) {
+        poly.v[i] = clipc.col(i);
+        poly.bar[i] = Vec3f(i==0, i==1, i==2);
+    }
+    const bool clipped = any & (1<<4 | 1<<5);
+    if (clipped) {
+        clip_polygon(poly, 3, params.near_w);
+        clip_polygon(poly, 2, params.far_z);
+        if (poly.n<3) {
+            stats.frustum++;
+            return 0;
+        }
+    }
+    if (params.cull_backfaces) {
+        // twice the signed screen area, positive when counter-clockwise (the front faces of an .obj)
+        float area = 0;
+        Vec2f p[5];
+        for (int i=0; i<poly.n; i++) {
+            Vec4f s = viewport*poly.v[i];
+            p[i] = Vec2f(s[0]/s[3], s[1]/s[3]);
+        }
+        for (int i=0; i<poly.n; i++) {
+            int j = (i+1)%poly.n;
+            area += p[i].x*p[j].y - p[j].x*p[i].y;
+        }
+        if (area<0) {
+            stats.backface++;
+            return 0;
+        }
+    }
+    if (!clipped) return 1;
+    stats.clipped++;
+    return 2;
+}
+
+// compatibility path, the fragment shader goes through the virtual call
+int triangle(RenderContext &ctx, mat<4,3,float> &clipc, IShader &shader) {
+    return triangle<IShader>(ctx, clipc, shader, 0, 0, ctx.width()-1, ctx.height()-1);
+}
+
+int triangle(RenderContext &ctx, mat<4,3,float> &clipc, IShader &shader, int xmin, int ymin, int xmax, int ymax) {
+    return triangle<IShader>(ctx, clipc, shader, xmin, ymin, xmax, ymax);
+}
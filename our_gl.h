@@ -1,15 +1,18 @@
 #ifndef __OUR_GL_H__
 #define __OUR_GL_H__
+#include <bit>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
 #include "tgaimage.h"
+#include "render_target.h"
 #include "geometry.h"
-
-extern Matrix ModelView;
-extern Matrix Projection;
-extern Matrix Viewport;
-
-void viewport(int x, int y, int w, int h);
-void projection(float coeff=0.f); // coeff = -1/c
-void lookat(Vec3f eye, Vec3f center, Vec3f up);
+#include "model.h"
+#include "vertex_cache.h"
+#include "parallel.h"
+#include "simd.h"
+#include "profile.h"
 
 struct IShader {
     virtual ~IShader();
@@ -17,6 +20,476 @@ struct IShader {
     virtual bool fragment(Vec3f gl_FragCoord, Vec3f bar, TGAColor &color) = 0;
 };
 
+const int TILE_SIZE  = 64; // binning tiles of draw()
+const int BLOCK_SIZE = 8;  // early rejection blocks of triangle(), TILE_SIZE must be a multiple of it
+
+// Hierarchical depth over a zbuffer: the farthest (smallest) depth of every BLOCK_SIZE tile and of every
+// TILE_SIZE tile. The values are kept conservative (never above the zbuffer content), so a triangle whose
+// closest depth is below them is hidden. triangle() refreshes the tiles it writes to.
+struct HiZ {
+    int width, height;
+    int ntx, nty;              // BLOCK_SIZE tiles
+    int ncx, ncy;              // TILE_SIZE tiles
+    std::vector<float> tiles;  // ntx*nty
+    std::vector<float> coarse; // ncx*ncy
+    HiZ(int w, int h);
+    void clear(); // matches a zbuffer filled with -max float
+    bool update_tile(const float *zbuffer, int tx, int ty); // true if the tile got farther
+    bool update_tile(const uint16_t *zbuffer, float zmin, float scale, int tx, int ty); // 16-bit zbuffer, see RenderContext
+    void update_coarse(int cx, int cy);
+};
+
+enum DepthFormat {
+    DEPTH32F, // float depths
+    DEPTH16   // 16-bit fixed point over a depth range, depth-only passes (e.g. shadow maps) only
+};
+
+enum DepthTest {
+    DEPTH_GEQUAL, // a fragment at least as close as the zbuffer passes and writes its depth
+    DEPTH_EQUAL   // only a fragment at exactly the zbuffer depth passes, nothing is written: shading after a depth prepass
+};
+
+// Everything a frame is rendered with: the transforms, the render targets and the bound mesh.
+// Contexts share no mutable state, so independent frames can be rendered concurrently on separate threads.
+// A context without color is a standalone depth target, e.g. a shadow map at its own resolution.
+struct RenderContext {
+    Matrix ModelView;
+    Matrix Projection;
+    Matrix Viewport;
+    RenderTarget framebuffer;        // empty without color
+    DepthFormat depth_format;
+    std::vector<float> zbuffer;      // DEPTH32F
+    std::vector<uint16_t> zbuffer16; // DEPTH16: (depth-depth_min)*depth_scale rounded, clamped to [0,65535]
+    float depth_min, depth_scale;
+    DepthTest depth_test;
+    HiZ hiz;            // kept in sync with the zbuffer by triangle()
+    const Model *model; // mesh drawn by draw()
+
+    RenderContext(int width, int height, bool color=true, DepthFormat format=DEPTH32F);
+    int width() const  { return hiz.width; }
+    int height() const { return hiz.height; }
+    void set_depth_range(float zmin, float zmax); // mapped to the DEPTH16 range, [-1,1] by default
+    float depth(int x, int y) const;              // zbuffer content in either format
+    void clear(); // black framebuffer, farthest depth everywhere
+};
+
+void viewport(RenderContext &ctx, int x, int y, int w, int h);
+void projection(RenderContext &ctx, float coeff=0.f); // coeff = -1/c
+void lookat(RenderContext &ctx, Vec3f eye, Vec3f center, Vec3f up);
+
+// reference barycentric coordinates of P, triangle() evaluates the same expressions incrementally
+Vec3f barycentric(Vec2f A, Vec2f B, Vec2f C, Vec2f P);
 //void triangle(Vec4f *pts, IShader &shader, TGAImage &image, float *zbuffer);
-void triangle(mat<4,3,float> &pts, IShader &shader, TGAImage &image, float *zbuffer);
-#endif //__OUR_GL_H__
\ No newline at end of file
+int triangle(RenderContext &ctx, mat<4,3,float> &pts, IShader &shader);
+// same, restricted to the pixels [xmin,xmax]x[ymin,ymax]
+int triangle(RenderContext &ctx, mat<4,3,float> &pts, IShader &shader, int xmin, int ymin, int xmax, int ymax);
+// clamped screen bounding box {xmin,ymin,xmax,ymax}, false if the triangle misses the image
+bool screen_bbox(const Matrix &viewport, mat<4,3,float> &pts, int width, int height, int bbox[4]);
+// upper bound of the depths triangle() may write for pts (max float if the triangle crosses w=0)
+float closest_depth(mat<4,3,float> &pts);
+
+// Optional compile-time declarations of a shader, read by the templated triangle():
+//   static constexpr bool depth_only = true;    fragment() is never called and no color is written
+//   static constexpr int  nvaryings  = 0;       fragment() does not read its barycentric coordinates
+//   static constexpr bool writes_color = false; fragment() runs but its color is not stored
+// A shader declaring nvaryings = N > 0 along with a member  mat<N,3,float> varying  (row k: varying k at the
+// three vertices, filled by vertex()) implements  bool fragment(Vec3f gl_FragCoord, const vec<N,float> &v, TGAColor &)
+// instead, v being the varyings already interpolated: triangle() sets up their plane equations (and the one
+// of 1/w) once per triangle, then a pixel costs a multiply-add per varying and one division.
+//   static constexpr bool uses_textures = true; the shader samples mipmapped textures: its plane varyings 0 and 1
+// are the uv, and triangle() fills its members  Vec2f duvdx, duvdy  with their screen-space derivatives once per
+// triangle (see Texture::lod()). Shaders that do not declare it get no derivative work at all.
+template <class Shader> constexpr bool shader_depth_only() {
+    if constexpr (requires { Shader::depth_only; }) return Shader::depth_only;
+    else return false;
+}
+
+template <class Shader> constexpr bool shader_writes_color() {
+    if constexpr (shader_depth_only<Shader>()) return false;
+    else if constexpr (requires { Shader::writes_color; }) return Shader::writes_color;
+    else return true;
+}
+
+template <class Shader> constexpr bool shader_plane_varyings() {
+    if constexpr (shader_depth_only<Shader>()) return false;
+    else if constexpr (requires (Shader &s) { Shader::nvaryings; s.varying; }) return Shader::nvaryings>0;
+    else return false;
+}
+
+template <class Shader> constexpr int shader_plane_count() {
+    if constexpr (shader_plane_varyings<Shader>()) return Shader::nvaryings;
+    else return 0;
+}
+
+template <class Shader> constexpr bool shader_uses_textures() {
+    if constexpr (shader_plane_count<Shader>()<2) return false;
+    else if constexpr (requires (Shader &s) { Shader::uses_textures; s.duvdx = s.duvdy; }) return Shader::uses_textures;
+    else return false;
+}
+
+template <class Shader> constexpr bool shader_needs_bar() {
+    if constexpr (shader_depth_only<Shader>() || shader_plane_varyings<Shader>()) return false;
+    else if constexpr (requires { Shader::nvaryings; }) return Shader::nvaryings>0;
+    else return true;
+}
+
+// Edge-function rasterizer: the bounding box is walked in BLOCK_SIZE x BLOCK_SIZE blocks, row by row,
+// vfloat::N pixels at a time. A block is skipped as soon as its four corners lie outside one of the edges.
+// The per-pixel arithmetic is the one of barycentric(), so the coverage and the depths are unchanged.
+// Hidden triangles and blocks are dropped on the HiZ of the context before any per-pixel work.
+// Shader is inlined into the pixel loop unless it is abstract (IShader), and its traits
+// (see shader_depth_only(), shader_needs_bar() and shader_plane_varyings()) remove the work it does not need.
+// Z is the zbuffer element type: float, or uint16_t for DEPTH16 contexts (depth-only shaders).
+// Returns the number of fragments that passed the depth test.
+template <class Shader, class Z> int rasterize(RenderContext &ctx, Z *zbuffer, mat<4,3,float> &clipc, Shader &shader,
+                                                int xmin, int ymin, int xmax, int ymax, const mat<3,3,float> *bar_map) {
+    int bbox[4];
+    const int width = ctx.width();
+    RenderTarget &image = ctx.framebuffer;
+    const bool color = shader_writes_color<Shader>() && image.width()>0;
+    const bool equal = ctx.depth_test==DEPTH_EQUAL;
+    HiZ *hiz = &ctx.hiz;
+    if (!screen_bbox(ctx.Viewport, clipc, width, ctx.height(), bbox)) return 0;
+    xmin = std::max(xmin, bbox[0]); xmax = std::min(xmax, bbox[2]);
+    ymin = std::max(ymin, bbox[1]); ymax = std::min(ymax, bbox[3]);
+    if (xmin>xmax || ymin>ymax) return 0;
+
+    const float zmax = closest_depth(clipc);
+    bool hidden = true;
+    for (int cy=ymin/TILE_SIZE; hidden && cy<=ymax/TILE_SIZE; cy++)
+        for (int cx=xmin/TILE_SIZE; hidden && cx<=xmax/TILE_SIZE; cx++)
+            hidden = hiz->coarse[cx+cy*hiz->ncx]>zmax;
+    if (hidden) return 0;
+
+    mat<3,4,float> pts = (ctx.Viewport*clipc).transpose(); // transposed to ease access to each of the points
+    Vec2f A = proj<2>(pts[0]/pts[0][3]), B = proj<2>(pts[1]/pts[1][3]), C = proj<2>(pts[2]/pts[2][3]);
+    const float CAx = C.x-A.x, BAx = B.x-A.x, CAy = C.y-A.y, BAy = B.y-A.y;
+    const float uz = CAx*BAy - BAx*CAy;
+    if (std::abs(uz)<=1e-2) return 0; // degenerate triangle
+
+    // edge functions of barycentric() up to the 1/uz factor, and a bound on their rounding error
+    auto edges = [&](float px, float py, float e[3]) {
+        float ex = A.x-px, ey = A.y-py;
+        e[2] = BAx*ey - ex*BAy;
+        e[1] = ex*CAy - CAx*ey;
+        e[0] = uz - e[1] - e[2];
+        for (int i=0; i<3; i++) if (uz<0) e[i] = -e[i];
+    };
+    const float slack = 1e-6f*(std::abs(CAx)+std::abs(BAx)+std::abs(CAy)+std::abs(BAy))*(width+ctx.height());
+
+    // plane equations f0 + gx*(x-A.x) + gy*(y-A.y) of varying/w for every varying, and of 1/w last
+    constexpr bool plane = shader_plane_varyings<Shader>();
+    constexpr int NV = shader_plane_count<Shader>();
+    float f0[NV+1], gx[NV+1], gy[NV+1];
+    if constexpr (plane) {
+        mat<NV,3,float> attr = shader.varying;
+        if (bar_map) attr = attr*(*bar_map); // the varyings at the corners of the clipped piece
+        for (int k=0; k<=NV; k++) {
+            float f[3];
+            for (int i=0; i<3; i++) f[i] = (k<NV ? attr[k][i] : 1.f)/pts[i][3];
+            const float d1 = f[1]-f[0], d2 = f[2]-f[0];
+            f0[k] = f[0];
+            gx[k] = (d2*BAy - d1*CAy)/uz;
+            gy[k] = (d1*CAx - d2*BAx)/uz;
+        }
+        if constexpr (shader_uses_textures<Shader>()) {
+            const Vec2f screen[3] = {A, B, C};
+            const Vec2f uv[3] = {Vec2f(attr[0][0], attr[1][0]), Vec2f(attr[0][1], attr[1][1]), Vec2f(attr[0][2], attr[1][2])};
+            uv_derivatives(screen, uv, shader.duvdx, shader.duvdy);
+        }
+    }
+    float vary[NV+1][vfloat::N];
+
+    const vfloat vA_x(A.x), vCAx(CAx), vBAx(BAx), vCAy(CAy), vBAy(BAy), vuz(uz), zero(0.f), one(1.f);
+    const vfloat w0(pts[0][3]), w1(pts[1][3]), w2(pts[2][3]);
+    const vfloat z0(clipc[2][0]), z1(clipc[2][1]), z2(clipc[2][2]);
+    const vfloat zlo(ctx.depth_min), zscale(ctx.depth_scale), zhalf(.5f), zone(65535.f);
+    float b0[vfloat::N], b1[vfloat::N], b2[vfloat::N], depth[vfloat::N];
+    TGAColor frag_color;
+    bool farther = false; // some HiZ tile got farther
+    int fragments = 0;
+    long long tested = 0, passed = 0, shaded = 0; // profiling counts, unused otherwise
+    for (int by=ymin-ymin%BLOCK_SIZE; by<=ymax; by+=BLOCK_SIZE) {
+        int y0 = std::max(by, ymin), y1 = std::min(by+BLOCK_SIZE-1, ymax);
+        for (int bx=xmin-xmin%BLOCK_SIZE; bx<=xmax; bx+=BLOCK_SIZE) {
+            int x0 = std::max(bx, xmin), x1 = std::min(bx+BLOCK_SIZE-1, xmax);
+            if (hiz->tiles[bx/BLOCK_SIZE+by/BLOCK_SIZE*hiz->ntx]>zmax) continue;
+            float e[4][3];
+            edges(x0, y0, e[0]); edges(x1, y0, e[1]); edges(x0, y1, e[2]); edges(x1, y1, e[3]);
+            bool outside = false;
+            for (int i=0; i<3; i++)
+                outside |= std::max(std::max(e[0][i], e[1][i]), std::max(e[2][i], e[3][i])) < -slack;
+            if (outside) continue;
+
+            bool written = false;
+            for (int y=y0; y<=y1; y++) {
+                const vfloat ey(A.y-(float)y);
+                for (int x=x0; x<=x1; x+=vfloat::N) {
+                    int n = std::min(vfloat::N, x1-x+1);
+                    vfloat ex = vA_x - (vfloat((float)x) + vfloat::ramp());
+                    vfloat ux = vBAx*ey - ex*vBAy;
+                    vfloat uy = ex*vCAy - vCAx*ey;
+                    vfloat l0 = one - (ux+uy)/vuz, l1 = uy/vuz, l2 = ux/vuz;
+                    int mask = ~movemask((l0<zero) | (l1<zero) | (l2<zero)) & ((1<<n)-1);
+                    if (!mask) continue;
+                    if constexpr (profile::enabled) tested += std::popcount((unsigned)mask);
+                    vfloat c0 = l0/w0, c1 = l1/w1, c2 = l2/w2;
+                    vfloat sum = c0+c1+c2;
+                    c0 = c0/sum; c1 = c1/sum; c2 = c2/sum;
+                    vfloat d = z2*c2 + z1*c1 + z0*c0;
+                    Z *zrow = zbuffer + x + y*width;
+                    if constexpr (std::is_same_v<Z, float>) {
+                        if (n==vfloat::N) {
+                            vfloat zr = vfloat::load(zrow);
+                            mask &= ~movemask(equal ? (zr > d) | (zr < d) : zr > d);
+                        }
+                        if (!mask) continue;
+                        d.store(depth);
+                    } else { // fixed point, rounded when converted to Z below
+                        vmin(vmax((d-zlo)*zscale + zhalf, zero), zone).store(depth);
+                    }
+                    if constexpr (shader_needs_bar<Shader>()) {
+                        c0.store(b0); c1.store(b1); c2.store(b2);
+                    }
+                    if constexpr (plane) {
+                        const vfloat dx = vfloat((float)x-A.x) + vfloat::ramp(), dy((float)y-A.y);
+                        const vfloat invq = one/(vfloat(f0[NV]) + vfloat(gx[NV])*dx + vfloat(gy[NV])*dy);
+                        for (int k=0; k<NV; k++)
+                            ((vfloat(f0[k]) + vfloat(gx[k])*dx + vfloat(gy[k])*dy)*invq).store(vary[k]);
+                    }
+                    for (int i=0; i<n; i++) {
+                        if (!(mask>>i & 1) || (equal ? zrow[i]!=(Z)depth[i] : zrow[i]>(Z)depth[i])) continue;
+                        if constexpr (profile::enabled) passed++;
+                        if constexpr (!shader_depth_only<Shader>()) {
+                            if constexpr (profile::enabled) shaded++;
+                            Vec3f bar;
+                            if constexpr (shader_needs_bar<Shader>()) {
+                                bar = Vec3f(b0[i], b1[i], b2[i]);
+                                if (bar_map) bar = (*bar_map)*bar;
+                            }
+                            bool discard;
+                            if constexpr (plane) {
+                                vec<NV,float> v;
+                                for (int k=0; k<NV; k++) v[k] = vary[k][i];
+                                discard = shader.Shader::fragment(Vec3f(x+i, y, depth[i]), v, frag_color);
+                            } else if constexpr (std::is_abstract_v<Shader>)
+                                discard = shader.fragment(Vec3f(x+i, y, depth[i]), bar, frag_color);
+                            else
+                                discard = shader.Shader::fragment(Vec3f(x+i, y, depth[i]), bar, frag_color);
+                            if (discard) continue;
+                            if (color) image.row(y)[x+i] = RenderTarget::pack(frag_color);
+                        }
+                        fragments++;
+                        if (equal) continue;
+                        zrow[i] = (Z)depth[i];
+                        written = true;
+                    }
+                }
+            }
+            if (!written) continue;
+            if constexpr (std::is_same_v<Z, float>)
+                farther |= hiz->update_tile(zbuffer, bx/BLOCK_SIZE, by/BLOCK_SIZE);
+            else
+                farther |= hiz->update_tile(zbuffer, ctx.depth_min, ctx.depth_scale, bx/BLOCK_SIZE, by/BLOCK_SIZE);
+        }
+    }
+    if (farther)
+        for (int cy=ymin/TILE_SIZE; cy<=ymax/TILE_SIZE; cy++)
+            for (int cx=xmin/TILE_SIZE; cx<=xmax/TILE_SIZE; cx++)
+                hiz->update_coarse(cx, cy);
+    PROFILE_COUNT(PIXELS_TESTED, tested);
+    PROFILE_COUNT(DEPTH_PASSED, passed);
+    PROFILE_COUNT(DEPTH_FAILED, tested-passed);
+    PROFILE_COUNT(FRAGMENTS_SHADED, shaded);
+    return fragments;
+}
+
+// bar_map, if given, maps the barycentric coordinates in clipc to the ones passed to fragment() (clipped pieces).
+// DEPTH16 contexts only take depth-only shaders, other draws into them are ignored.
+// Returns the number of fragments that passed the depth test.
+template <class Shader> int triangle(RenderContext &ctx, mat<4,3,float> &clipc, Shader &shader,
+                                     int xmin, int ymin, int xmax, int ymax, const mat<3,3,float> *bar_map=NULL) {
+    PROFILE_SCOPE_UNTRACED("triangle");
+    if (ctx.depth_format==DEPTH32F)
+        return rasterize(ctx, ctx.zbuffer.data(), clipc, shader, xmin, ymin, xmax, ymax, bar_map);
+    if constexpr (shader_depth_only<Shader>())
+        return rasterize(ctx, ctx.zbuffer16.data(), clipc, shader, xmin, ymin, xmax, ymax, bar_map);
+    return 0;
+}
+
+template <class Shader> int triangle(RenderContext &ctx, mat<4,3,float> &clipc, Shader &shader) {
+    return triangle(ctx, clipc, shader, 0, 0, ctx.width()-1, ctx.height()-1);
+}
+
+struct DrawParams {
+    int  nthreads = 0;         // 0 = all cores
+    bool front_to_back = false; // sort the triangles by their closest depth first (changes the order of equal-depth writes)
+    bool cull_backfaces = false; // drop the triangles that are clockwise on screen
+    float near_w = 1e-3f;       // near clip plane w = near_w, just in front of the eye (w = 1-z/c)
+    float far_z = -std::numeric_limits<float>::max(); // far clip plane on the depth, smaller is farther (off by default)
+    const std::vector<int> *faces = NULL; // faces of ctx.model to draw, in this order, all of them if NULL
+    int copies = 1;             // instanced draws: the faces are submitted this many times, copy after copy
+};
+
+// triangle counts of a draw() call
+struct DrawStats {
+    int triangles = 0;  // faces submitted (params.faces or the whole model)
+    int frustum = 0;    // entirely outside the image or the near/far planes
+    int backface = 0;   // culled as back faces
+    int clipped = 0;    // crossed the near or far plane and were cut
+    int rasterized = 0; // triangles binned for rasterization, clipped pieces included
+    long long fragments = 0; // fragments that passed the depth test (and were not discarded)
+};
+
+// A triangle cut by the clip planes: at most one more vertex per plane, each with its
+// barycentric coordinates in the original triangle
+struct ClippedPolygon {
+    int n;
+    Vec4f v[5];
+    Vec3f bar[5];
+};
+
+// Primitive assembly of a triangle in clip coordinates: frustum rejection against the image borders and the
+// near/far planes, clipping against near/far only (x and y are left to the guard band of the rasterizer,
+// which clamps the bounding box) and optional back-face culling. Returns 0 when the triangle is dropped,
+// 1 when it is to be rasterized as is, 2 when it was clipped into poly, a fan of poly.n-2 triangles.
+int assemble(const Matrix &viewport, int width, int height, const DrawParams &params, mat<4,3,float> &clipc,
+             ClippedPolygon &poly, DrawStats &stats);
+
+// Draws the faces of ctx.model (params.faces if given), same image as calling triangle() face by face
+// (in front_to_back order if asked) on the triangles that pass assemble().
+// The post-transform triangles are binned into TILE_SIZE screen tiles, then every tile is rasterized
+// by one worker in submission order, so each pixel sees exactly the same sequence of depth tests.
+// Each worker owns a copy of the shader and re-runs vertex() to restore the varyings of the triangle
+// it rasterizes: Shader must be copyable and vertex() must only depend on its arguments and uniforms.
+// With params.copies > 1, a shader member  int instance  receives the copy of the face before every vertex() call.
+template <class Shader> DrawStats draw(RenderContext &ctx, Shader &shader, const DrawParams &params=DrawParams()) {
+    PROFILE_SCOPE("draw");
+    const int nmodel = params.faces ? (int)params.faces->size() : ctx.model->nfaces(), width = ctx.width(), height = ctx.height();
+    const int nfaces = nmodel*std::max(params.copies, 1);
+    auto face = [&](int i) { i %= nmodel; return params.faces ? (*params.faces)[i] : i; }; // primitive -> face of the model
+    auto vertex = [&](Shader &s, int i, int j) { // vertex j of primitive i
+        if constexpr (requires { s.instance; }) s.instance = i/nmodel;
+        return s.vertex(face(i), j);
+    };
+    const int ntx = (width+TILE_SIZE-1)/TILE_SIZE, nty = (height+TILE_SIZE-1)/TILE_SIZE;
+    const int nblocks = (nfaces+1023)/1024;
+
+    // pieces of the clipped faces, numbered after the faces: primitive nfaces+k is pieces[k]
+    struct Piece {
+        int prim; // index of the face in the submission
+        mat<4,3,float> clipc;
+        mat<3,3,float> bar;
+    };
+    std::vector<std::vector<Piece> > block_pieces(nblocks);
+    std::vector<DrawStats> block_stats(nblocks);
+    std::vector<int> bboxes(nfaces*4);
+    std::vector<float> zmax(nfaces);
+    std::vector<char> visible(nfaces);
+    parallel_for(nblocks, params.nthreads, [&](int b) {
+        PROFILE_SCOPE("vertex");
+        Shader s = shader;
+        mat<4,3,float> clipc;
+        ClippedPolygon poly;
+        for (int i=b*1024; i<std::min(nfaces, (b+1)*1024); i++) {
+            for (int j=0; j<3; j++) clipc.set_col(j, vertex(s, i, j));
+            int res = assemble(ctx.Viewport, width, height, params, clipc, poly, block_stats[b]);
+            visible[i] = res==1 && screen_bbox(ctx.Viewport, clipc, width, height, &bboxes[i*4]);
+            zmax[i] = res==1 ? closest_depth(clipc) : 0.f;
+            for (int k=1; res==2 && k+1<poly.n; k++) {
+                Piece p;
+                p.prim = i;
+                const int corners[3] = {0, k, k+1};
+                for (int j=0; j<3; j++) {
+                    p.clipc.set_col(j, poly.v[corners[j]]);
+                    p.bar.set_col(j, poly.bar[corners[j]]);
+                }
+                block_pieces[b].push_back(p);
+            }
+        }
+    });
+
+    DrawStats stats;
+    std::vector<Piece> pieces;
+    for (int b=0; b<nblocks; b++) {
+        pieces.insert(pieces.end(), block_pieces[b].begin(), block_pieces[b].end());
+        stats.frustum  += block_stats[b].frustum;
+        stats.backface += block_stats[b].backface;
+        stats.clipped  += block_stats[b].clipped;
+    }
+    const int nprims = nfaces + (int)pieces.size();
+    bboxes.resize(nprims*4);
+    zmax.resize(nprims);
+    visible.resize(nprims);
+    for (int k=0; k<(int)pieces.size(); k++) {
+        visible[nfaces+k] = screen_bbox(ctx.Viewport, pieces[k].clipc, width, height, &bboxes[(nfaces+k)*4]);
+        zmax[nfaces+k] = closest_depth(pieces[k].clipc);
+    }
+
+    // submission order: the pieces of a clipped face take its place
+    std::vector<int> order;
+    order.reserve(nprims);
+    for (int i=0, k=0; i<nfaces; i++) {
+        order.push_back(i);
+        for (; k<(int)pieces.size() && pieces[k].prim==i; k++) order.push_back(nfaces+k);
+    }
+    if (params.front_to_back)
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return zmax[a]>zmax[b]; });
+
+    std::vector<std::vector<int> > bins(ntx*nty);
+    for (int i : order) {
+        if (!visible[i]) continue;
+        stats.rasterized++;
+        const int *bbox = &bboxes[i*4];
+        for (int ty=bbox[1]/TILE_SIZE; ty<=bbox[3]/TILE_SIZE; ty++)
+            for (int tx=bbox[0]/TILE_SIZE; tx<=bbox[2]/TILE_SIZE; tx++)
+                bins[tx+ty*ntx].push_back(i);
+    }
+
+    std::vector<long long> tile_fragments(ntx*nty);
+    parallel_for(ntx*nty, params.nthreads, [&](int t) {
+        PROFILE_SCOPE("raster");
+        Shader s = shader;
+        mat<4,3,float> clipc;
+        int x0 = (t%ntx)*TILE_SIZE, y0 = (t/ntx)*TILE_SIZE;
+        int x1 = std::min(x0+TILE_SIZE, width)-1, y1 = std::min(y0+TILE_SIZE, height)-1;
+        for (int i : bins[t]) {
+            if (ctx.hiz.coarse[t]>zmax[i]) continue;
+            if (i<nfaces) {
+                for (int j=0; j<3; j++) clipc.set_col(j, vertex(s, i, j));
+                tile_fragments[t] += triangle(ctx, clipc, s, x0, y0, x1, y1);
+            } else {
+                const Piece &p = pieces[i-nfaces];
+                for (int j=0; j<3; j++) vertex(s, p.prim, j);
+                clipc = p.clipc;
+                tile_fragments[t] += triangle(ctx, clipc, s, x0, y0, x1, y1, &p.bar);
+            }
+        }
+    });
+    for (long long f : tile_fragments) stats.fragments += f;
+    stats.triangles = nfaces;
+    PROFILE_COUNT(TRIANGLES_SUBMITTED, nfaces);
+    PROFILE_COUNT(TRIANGLES_CULLED, stats.frustum+stats.backface);
+    return stats;
+}
+
+// Depth-only shader over the post-transform vertex cache: no varyings, no fragment work, no color writes.
+// In instanced draws the cache holds one copy of the vertices per instance (see VertexCache::transform()).
+struct DepthShader {
+    static constexpr bool depth_only = true;
+    const Model *model;
+    const VertexCache *clip;
+    int instance = 0;
+    Vec4f vertex(int iface, int nthvert) { return (*clip)[instance*model->nverts() + model->face(iface)[nthvert]]; }
+    bool fragment(Vec3f, Vec3f, TGAColor &) { return false; }
+};
+
+// Depth pass of ctx.model whose vertices clip holds in clip coordinates: a z prepass (follow it with
+// ctx.depth_test = DEPTH_EQUAL to shade every pixel once) or a shadow map in a context without color.
+inline DrawStats draw_depth(RenderContext &ctx, const VertexCache &clip, const DrawParams &params=DrawParams()) {
+    DepthShader shader;
+    shader.model = ctx.model;
+    shader.clip = &clip;
+    return draw(ctx, shader, params);
+}
+#endif //__OUR_GL_H__
@@ -0,0 +1,54 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// threads that nthreads<=0 stands for on the calling thread, 0 = every hardware thread (see ThreadBudget)
+inline int &thread_budget() {
+    static thread_local int budget = 0;
+    return budget;
+}
+
+// 0 (or negative) means "use every hardware thread", or the budget of the calling thread if one is set
+inline int resolve_threads(int nthreads) {
+    if (nthreads>0) return nthreads;
+    if (thread_budget()>0) return thread_budget();
+    int n = (int)std::thread::hardware_concurrency();
+    return n>0 ? n : 1;
+}
+
+// Caps the loops run with nthreads<=0 on this thread for the lifetime of the object, e.g. for the library
+// calls made by the workers of a pool, which would otherwise each spawn one thread per core.
+class ThreadBudget {
+    int saved_;
+public:
+    explicit ThreadBudget(int nthreads) : saved_(thread_budget()) { thread_budget() = std::max(nthreads, 1); }
+    ~ThreadBudget() { thread_budget() = saved_; }
+    ThreadBudget(const ThreadBudget &) = delete;
+    ThreadBudget & operator =(const ThreadBudget &) = delete;
+};
+
+// runs fn(tid) on nthreads threads, the calling thread being tid 0
+template <class F> void parallel_run(int nthreads, F fn) {
+    nthreads = resolve_threads(nthreads);
+    std::vector<std::thread> pool;
+    for (int t=1; t<nthreads; t++) pool.emplace_back(fn, t);
+    fn(0);
+    for (std::thread &th : pool) th.join();
+}
+
+// hands the indices [0,n) out one by one to fn(i) over nthreads threads
+template <class F> void parallel_for(int n, int nthreads, F fn) {
+    std::atomic<int> next(0);
+    nthreads = std::min(resolve_threads(nthreads), n);
+    if (nthreads<=1) {
+        for (int i=0; i<n; i++) fn(i);
+        return;
+    }
+    parallel_run(nthreads, [&](int) {
+        for (int i; (i = next++)<n; ) fn(i);
+    });
+}
+#endif //__PARALLEL_H__
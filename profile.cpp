@@ -0,0 +1,174 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include "profile.h"
+
+#ifdef TINY_RENDERER_PROFILE
+namespace profile {
+namespace {
+    const char *counter_names[NCOUNTERS] = {"triangles_submitted", "triangles_culled", "pixels_tested", "depth_passed",
+                                            "depth_failed", "fragments_shaded", "pixels_covered"};
+
+    struct Timer {
+        const char *name;
+        long long ns, calls;
+    };
+
+    struct Event {
+        const char *name;
+        long long start, duration; // ns since the epoch
+    };
+
+    // everything a thread records; a log outlives its thread and is handed to the next thread that starts
+    struct ThreadLog {
+        int tid;
+        bool in_use;
+        std::vector<Timer> timers;
+        long long counters[NCOUNTERS];
+        std::vector<Event> events;
+    };
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadLog> > logs;
+    std::atomic<bool> tracing(false);
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    long long now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-epoch).count();
+    }
+
+    struct Handle {
+        ThreadLog *log = NULL;
+        ~Handle() {
+            if (!log) return;
+            std::lock_guard<std::mutex> lock(mutex);
+            log->in_use = false;
+        }
+    };
+    thread_local Handle handle;
+
+    ThreadLog &local() {
+        if (handle.log) return *handle.log;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (std::unique_ptr<ThreadLog> &l : logs)
+            if (!l->in_use) handle.log = l.get();
+        if (!handle.log) {
+            logs.emplace_back(new ThreadLog());
+            handle.log = logs.back().get();
+            handle.log->tid = (int)logs.size();
+            std::memset(handle.log->counters, 0, sizeof(handle.log->counters));
+        }
+        handle.log->in_use = true;
+        return *handle.log;
+    }
+
+    std::string escape(const std::string &s) {
+        std::string res;
+        for (char c : s) {
+            if (c=='"' || c=='\\') res += '\\';
+            res += c;
+        }
+        return res;
+    }
+}
+
+void reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (std::unique_ptr<ThreadLog> &l : logs) {
+        l->timers.clear();
+        std::memset(l->counters, 0, sizeof(l->counters));
+    }
+}
+
+void report(std::ostream &out, Format format, const std::string &frame, bool header) {
+    std::vector<Timer> timers;
+    long long counters[NCOUNTERS] = {};
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (std::unique_ptr<ThreadLog> &l : logs) {
+            for (const Timer &t : l->timers) {
+                size_t i = 0;
+                while (i<timers.size() && std::strcmp(timers[i].name, t.name)) i++;
+                if (i==timers.size()) timers.push_back(Timer{t.name, 0, 0});
+                timers[i].ns += t.ns;
+                timers[i].calls += t.calls;
+            }
+            for (int c=0; c<NCOUNTERS; c++) counters[c] += l->counters[c];
+        }
+    }
+    const double overdraw = counters[PIXELS_COVERED] ? (double)counters[DEPTH_PASSED]/counters[PIXELS_COVERED] : 0.;
+
+    if (format==CSV) {
+        if (header) out << "frame,metric,value,calls\n";
+        for (const Timer &t : timers)
+            out << frame << "," << t.name << "_ms," << t.ns*1e-6 << "," << t.calls << "\n";
+        for (int c=0; c<NCOUNTERS; c++)
+            out << frame << "," << counter_names[c] << "," << counters[c] << ",\n";
+        out << frame << ",overdraw," << overdraw << ",\n";
+    } else {
+        out << "{\"frame\":\"" << escape(frame) << "\",\"timers\":{";
+        for (size_t i=0; i<timers.size(); i++)
+            out << (i ? "," : "") << "\"" << timers[i].name << "\":{\"ms\":" << timers[i].ns*1e-6 << ",\"calls\":" << timers[i].calls << "}";
+        out << "},\"counters\":{";
+        for (int c=0; c<NCOUNTERS; c++)
+            out << "\"" << counter_names[c] << "\":" << counters[c] << ",";
+        out << "\"overdraw\":" << overdraw << "}}\n";
+    }
+    out.flush();
+}
+
+void enable_trace(bool on) {
+    tracing = on;
+}
+
+bool write_trace(const char *filename) {
+    std::ofstream out(filename);
+    if (!out) {
+        std::cerr << "can't open trace file " << filename << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    for (std::unique_ptr<ThreadLog> &l : logs)
+        for (const Event &e : l->events) {
+            out << (first ? "\n" : ",\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << l->tid
+                << ",\"ts\":" << e.start*1e-3 << ",\"dur\":" << e.duration*1e-3 << "}";
+            first = false;
+        }
+    out << "\n]}\n";
+    return out.good();
+}
+
+void count(Counter counter, long long n) {
+    local().counters[counter] += n;
+}
+
+ScopedTimer::ScopedTimer(const char *name, bool trace) : name_(name), trace_(trace), start_(now()) {}
+
+ScopedTimer::~ScopedTimer() {
+    long long duration = now()-start_;
+    ThreadLog &log = local();
+    size_t i = 0;
+    while (i<log.timers.size() && log.timers[i].name!=name_ && std::strcmp(log.timers[i].name, name_)) i++;
+    if (i==log.timers.size()) log.timers.push_back(Timer{name_, 0, 0});
+    log.timers[i].ns += duration;
+    log.timers[i].calls++;
+    if (trace_ && tracing) log.events.push_back(Event{name_, start_, duration});
+}
+}
+
+#else // instrumentation compiled out: the reporting entry points do nothing
+
+namespace profile {
+void reset() {}
+void report(std::ostream &, Format, const std::string &, bool) {}
+void enable_trace(bool) {}
+bool write_trace(const char *) { return false; }
+}
+#endif
@@ -0,0 +1,68 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+#include <ostream>
+#include <string>
+
+// Per-stage instrumentation: scoped timers and event counters, built only with -DTINY_RENDERER_PROFILE
+// (CMake option of the same name). Without it the macros expand to nothing and the hot loops keep no counts.
+//   PROFILE_SCOPE("name")          times the enclosing scope, also recorded as a Chrome trace event
+//   PROFILE_SCOPE_UNTRACED("name") times the enclosing scope, totals only (for scopes run millions of times)
+//   PROFILE_COUNT(COUNTER, n)      adds n to a counter
+// Every thread accumulates into its own log, the logs are merged by report(), which must not run
+// concurrently with instrumented code.
+namespace profile {
+#ifdef TINY_RENDERER_PROFILE
+    constexpr bool enabled = true;
+#else
+    constexpr bool enabled = false;
+#endif
+
+    enum Counter {
+        TRIANGLES_SUBMITTED, // faces handed to draw()
+        TRIANGLES_CULLED,    // dropped by the frustum or back-face tests (meshlet culling excluded)
+        PIXELS_TESTED,       // pixels inside a rasterized triangle that reached the depth test
+        DEPTH_PASSED,
+        DEPTH_FAILED,
+        FRAGMENTS_SHADED,    // fragment() calls
+        PIXELS_COVERED,      // distinct pixels of the frame, reported by the caller (overdraw = DEPTH_PASSED/PIXELS_COVERED)
+        NCOUNTERS
+    };
+
+    enum Format { JSON, CSV };
+
+    // clears the timers and counters (not the trace)
+    void reset();
+    // Writes the timers (total ms and calls) and counters accumulated since the last reset(), tagged with frame:
+    // one JSON object per line, or CSV rows frame,metric,value,calls preceded by a header line if header is set.
+    void report(std::ostream &out, Format format, const std::string &frame, bool header=false);
+    // Starts keeping the PROFILE_SCOPE events for write_trace() (off by default, the events are kept in memory).
+    void enable_trace(bool on=true);
+    // Chrome trace-event file of all the events recorded so far (chrome://tracing, Perfetto).
+    bool write_trace(const char *filename);
+
+    void count(Counter counter, long long n);
+
+    class ScopedTimer {
+        const char *name_;
+        bool trace_;
+        long long start_;
+    public:
+        ScopedTimer(const char *name, bool trace=true);
+        ~ScopedTimer();
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer & operator =(const ScopedTimer &) = delete;
+    };
+}
+
+#ifdef TINY_RENDERER_PROFILE
+#define PROFILE_CAT2_(a, b) a##b
+#define PROFILE_CAT_(a, b) PROFILE_CAT2_(a, b)
+#define PROFILE_SCOPE(name) profile::ScopedTimer PROFILE_CAT_(profile_scope_, __LINE__)(name)
+#define PROFILE_SCOPE_UNTRACED(name) profile::ScopedTimer PROFILE_CAT_(profile_scope_, __LINE__)(name, false)
+#define PROFILE_COUNT(counter, n) profile::count(profile::counter, n)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_SCOPE_UNTRACED(name)
+#define PROFILE_COUNT(counter, n)
+#endif
+#endif //__PROFILE_H__
@@ -0,0 +1,56 @@
+#include <algorithm>
+#include <cstdint>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "render_target.h"
+
+static const int ROW_ALIGN = 64; // bytes
+
+RenderTarget::RenderTarget(int w, int h) : width_(w), height_(h), pitch_(0), storage_(), data_(NULL) {
+    const int per_line = ROW_ALIGN/sizeof(uint32_t);
+    pitch_ = (w+per_line-1)/per_line*per_line;
+    storage_.assign((size_t)pitch_*h + per_line, 0);
+    uintptr_t base = (uintptr_t)storage_.data();
+    data_ = (uint32_t *)((base+ROW_ALIGN-1)/ROW_ALIGN*ROW_ALIGN);
+}
+
+void RenderTarget::fill(int x0, int y0, int x1, int y1, uint32_t color) {
+    x0 = std::max(x0, 0); y0 = std::max(y0, 0);
+    x1 = std::min(x1, width_); y1 = std::min(y1, height_);
+    // full rows are padded to the pitch, so the store loop below never needs a scalar tail there
+    if (x0==0 && x1==width_) x1 = pitch_;
+    for (int y=y0; y<y1; y++) {
+        uint32_t *p = row(y), *end = p+x1;
+        p += x0;
+#if defined(__AVX2__)
+        const __m256i v = _mm256_set1_epi32((int)color);
+        for (; p<end && ((uintptr_t)p & 31); p++) *p = color;
+        for (; p+8<=end; p+=8) _mm256_store_si256((__m256i *)p, v);
+#elif defined(__SSE2__)
+        const __m128i v = _mm_set1_epi32((int)color);
+        for (; p<end && ((uintptr_t)p & 15); p++) *p = color;
+        for (; p+4<=end; p+=4) _mm_store_si128((__m128i *)p, v);
+#endif
+        for (; p<end; p++) *p = color;
+    }
+}
+
+TGAImage RenderTarget::to_image(int bpp) const {
+    TGAImage img(width_, height_, bpp);
+    unsigned char *out = img.buffer();
+    for (int y=0; y<height_; y++) {
+        const unsigned char *in = (const unsigned char *)row(y);
+        unsigned char *dst = out + (size_t)y*width_*bpp;
+        if (bpp==4) {
+            std::memcpy(dst, in, (size_t)width_*4);
+            continue;
+        }
+        for (int x=0; x<width_; x++)
+            for (int i=0; i<bpp; i++)
+                dst[x*bpp+i] = in[x*4+i];
+    }
+    return img;
+}
@@ -0,0 +1,45 @@
+#ifndef __RENDER_TARGET_H__
+#define __RENDER_TARGET_H__
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "tgaimage.h"
+
+// Color buffer the rasterizer writes into: a fixed 4 bytes per pixel in the byte order of TGAColor
+// (b,g,r,a), rows starting on 64-byte boundaries. Accesses are unchecked; the image is converted to a
+// TGAImage only when it is written out.
+class RenderTarget {
+public:
+    RenderTarget(int w, int h);
+    RenderTarget(const RenderTarget &) = delete;
+    RenderTarget & operator =(const RenderTarget &) = delete;
+
+    int width() const  { return width_; }
+    int height() const { return height_; }
+    int pitch() const  { return pitch_; } // pixels from one row to the next
+
+    uint32_t *row(int y)             { return data_ + (size_t)y*pitch_; }
+    const uint32_t *row(int y) const { return data_ + (size_t)y*pitch_; }
+    void set(int x, int y, const TGAColor &c) { row(y)[x] = pack(c); }
+    TGAColor get(int x, int y) const {
+        uint32_t p = row(y)[x];
+        return TGAColor((const unsigned char *)&p, 4);
+    }
+
+    void clear(uint32_t color=0) { fill(0, 0, width_, height_, color); }
+    void fill(int x0, int y0, int x1, int y1, uint32_t color); // pixels [x0,x1)x[y0,y1), wide stores
+
+    // copy into a new TGAImage with bpp bytes per pixel
+    TGAImage to_image(int bpp=TGAImage::RGB) const;
+
+    static uint32_t pack(const TGAColor &c) {
+        uint32_t p;
+        std::memcpy(&p, c.bgra, 4);
+        return p;
+    }
+private:
+    int width_, height_, pitch_;
+    std::vector<uint32_t> storage_;
+    uint32_t *data_; // first row, 64-byte aligned inside storage_
+};
+#endif //__RENDER_TARGET_H__
@@ -0,0 +1,93 @@
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include "scene.h"
+#include "parallel.h"
+#include "texture_cache.h"
+
+bool read_scene(const char *filename, Scene &scene) {
+    std::ifstream in(filename);
+    if (!in) {
+        std::cerr << "can't open scene file " << filename << std::endl;
+        return false;
+    }
+    const std::filesystem::path dir = std::filesystem::path(filename).parent_path();
+    std::string line;
+    for (int lineno=1; std::getline(in, line); lineno++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream iss(line);
+        std::string path;
+        if (!(iss >> path)) continue;
+        SceneObject obj;
+        obj.path = (dir / path).string();
+        Vec3f t;
+        if (iss >> t.x) {
+            float scale = 1;
+            if (!(iss >> t.y >> t.z)) {
+                std::cerr << filename << ":" << lineno << ": expected a path and 3 or 4 numbers" << std::endl;
+                return false;
+            }
+            if (!(iss >> scale)) scale = 1;
+            for (int i=0; i<3; i++) {
+                obj.transform[i][i] = scale;
+                obj.transform[i][3] = t[i];
+            }
+        }
+        scene.objects.push_back(std::move(obj));
+    }
+    return true;
+}
+
+bool load_scene(Scene &scene, int nthreads) {
+    auto start = std::chrono::steady_clock::now();
+    struct Job {
+        int object;   // mesh of scene.objects[object], or texture -object-1 of scene.textures
+        std::string path;
+        uintmax_t size;
+    };
+    std::vector<Job> jobs;
+    std::vector<std::string> textures;
+    for (int i=0; i<(int)scene.objects.size(); i++) {
+        const std::string &path = scene.objects[i].path;
+        std::error_code ec;
+        jobs.push_back(Job{i, path, std::filesystem::file_size(path, ec)});
+        for (const std::string &t : model_texture_paths(path.c_str())) {
+            uintmax_t size = std::filesystem::file_size(t, ec);
+            if (ec || std::find(textures.begin(), textures.end(), t)!=textures.end()) continue; // missing maps are optional
+            textures.push_back(t);
+            jobs.push_back(Job{-(int)textures.size(), t, size});
+        }
+    }
+    std::stable_sort(jobs.begin(), jobs.end(), [](const Job &a, const Job &b) { return a.size>b.size; });
+
+    const size_t first = scene.timings.size(), first_texture = scene.textures.size();
+    scene.timings.resize(first + jobs.size());
+    scene.textures.resize(first_texture + textures.size());
+    // the parsers and decoders are parallel too: the threads are shared out so that there are nthreads in all
+    const int total = resolve_threads(nthreads), workers = std::max(1, std::min(total, (int)jobs.size()));
+    parallel_for((int)jobs.size(), workers, [&](int j) {
+        ThreadBudget budget(total/workers);
+        auto t0 = std::chrono::steady_clock::now();
+        const Job &job = jobs[j];
+        AssetTiming &timing = scene.timings[first+j];
+        if (job.object>=0) {
+            SceneObject &obj = scene.objects[job.object];
+            obj.model.reset(new Model(job.path.c_str(), true));
+            timing.ok = obj.model->nfaces()>0;
+        } else {
+            std::shared_ptr<const Texture> tex = TextureCache::instance().acquire(job.path);
+            timing.ok = !tex->empty();
+            scene.textures[first_texture-job.object-1] = tex;
+        }
+        timing.path = job.path;
+        timing.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-t0).count();
+    });
+    scene.load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+
+    for (const SceneObject &obj : scene.objects)
+        if (!obj.model->nfaces()) return false;
+    return true;
+}
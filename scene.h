@@ -0,0 +1,41 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+#include <memory>
+#include <string>
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+#include "texture.h"
+
+// A mesh of a scene and where it stands
+struct SceneObject {
+    std::string path;                      // .obj or .mesh
+    Matrix transform = Matrix::identity(); // object to world, an Instance transform (see draw_instanced())
+    std::unique_ptr<Model> model;          // NULL until load_scene()
+};
+
+// load time of one file of the scene
+struct AssetTiming {
+    std::string path;
+    double ms = 0;
+    bool ok = false;
+};
+
+struct Scene {
+    std::vector<SceneObject> objects;
+    std::vector<std::shared_ptr<const Texture> > textures; // maps of the models, held so the cache keeps them
+    std::vector<AssetTiming> timings; // one per mesh and texture file, in the order they were started
+    double load_ms = 0;               // wall time of load_scene()
+};
+
+// Manifest: one mesh per line,  path [tx ty tz [scale]]  ('#' starts a comment), the paths being relative
+// to the manifest. Appends the meshes to scene.objects, their models are left unloaded.
+bool read_scene(const char *filename, Scene &scene);
+
+// Loads the meshes of scene.objects (through their .mesh caches, see Model) and the textures found next to them
+// (see model_texture_paths()), every file being a job of a pool: the textures are decoded while the geometry
+// is parsed. nthreads bounds the threads of the pool and of the loaders together. The largest files are
+// started first, so the wall time tends to the load time of the largest asset rather than to the sum of all of
+// them. Returns false if a mesh could not be loaded.
+bool load_scene(Scene &scene, int nthreads=0);
+#endif //__SCENE_H__
@@ -0,0 +1,48 @@
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include "scene.h"
+#include "instancing.h"
+#include "vertex_cache.h"
+
+// Loads a scene manifest with load_scene() and prints the load time of every asset as CSV, then the wall time
+// against the sum of the asset times and the largest one. Run with nthreads=1 for the sequential baseline.
+// The meshes are then drawn in place (Gouraud shaded, see draw_instanced()) to scene.tga.
+// usage: scene-load [scene [nthreads]]
+
+int main(int argc, char** argv) {
+    const char *filename = argc>1 ? argv[1] : "../object/african_head/african_head.scene";
+    const int nthreads = argc>2 ? atoi(argv[2]) : 0;
+    Scene scene;
+    if (!read_scene(filename, scene)) return 1;
+    bool ok = load_scene(scene, nthreads);
+
+    double sum = 0, largest = 0;
+    std::cout << "asset,ms,ok" << std::endl;
+    for (const AssetTiming &t : scene.timings) {
+        std::cout << t.path << "," << t.ms << "," << t.ok << std::endl;
+        sum += t.ms;
+        largest = std::max(largest, t.ms);
+    }
+    std::cout << "# " << scene.objects.size() << " meshes, " << scene.textures.size() << " textures: "
+              << scene.load_ms << " ms wall, " << sum << " ms summed, " << largest << " ms largest asset" << std::endl;
+    if (!ok) return 1;
+
+    const int width = 800, height = 800;
+    RenderContext ctx(width, height);
+    Vec3f eye(1, 1, 3), center(0, 0, 0);
+    lookat(ctx, eye, center, Vec3f(0, 1, 0));
+    viewport(ctx, width/8, height/8, width*3/4, height*3/4);
+    projection(ctx, -1.f/(eye-center).norm());
+    DrawParams params;
+    params.cull_backfaces = true;
+    VertexCache clip;
+    std::vector<Instance> one(1);
+    for (const SceneObject &obj : scene.objects) {
+        ctx.model = obj.model.get();
+        one[0].transform = obj.transform;
+        draw_instanced(ctx, one, clip, Vec3f(1, 1, 1).normalize(), params);
+    }
+    ctx.framebuffer.to_image().write_tga_file("scene.tga", true, true);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <cmath>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include "model.h"
+#include "our_gl.h"
+#include "deferred.h"
+#include "vertex_cache.h"
+
+// Forward vs deferred shading of the same view: pixels shaded, time and image difference.
+// usage: shading-compare [model.obj [width height]]
+// The forward pass shades every fragment that passes the depth test at the time it is drawn (in submission
+// order), the deferred pass rasterizes a visibility buffer then shades each visible pixel once.
+
+// textured Phong with a normal map in object space, the light and the eye being in object space too;
+// varyings: uv then the object-space position, interpolated by the rasterizer.
+// The maps are sampled trilinearly, the mip level following the screen-space uv derivatives of the triangle.
+struct PhongShader {
+    static constexpr int nvaryings = 5;
+    static constexpr bool uses_textures = true;
+    const Model *model;
+    Matrix mvp;
+    Vec3f light, eye;
+    mat<5,3,float> varying;
+    Vec2f duvdx, duvdy; // set by the rasterizer
+
+    Vec4f vertex(int iface, int nthvert) {
+        Vec2f uv = model->uv(iface, nthvert);
+        Vec3f v = model->vert(iface, nthvert);
+        varying[0][nthvert] = uv.x; varying[1][nthvert] = uv.y;
+        for (int k=0; k<3; k++) varying[2+k][nthvert] = v[k];
+        return mvp*embed<4>(v);
+    }
+
+    bool fragment(Vec3f, const vec<5,float> &var, TGAColor &color) {
+        Vec2f uv(var[0], var[1]);
+        Vec3f n = model->normal(uv, duvdx, duvdy).normalize();
+        Vec3f v = (eye - Vec3f(var[2], var[3], var[4])).normalize();
+        Vec3f r = (n*(n*light*2.f) - light).normalize();
+        float spec = std::pow(std::max(r*v, 0.f), 5.f + model->specular(uv, duvdx, duvdy));
+        float diff = std::max(0.f, n*light);
+        TGAColor c = model->diffuse(uv, duvdx, duvdy);
+        color = c;
+        for (int i=0; i<3; i++) color[i] = std::min<float>(5 + c[i]*(diff + .6*spec), 255);
+        return false;
+    }
+};
+
+static double ms_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-t0).count();
+}
+
+int main(int argc, char** argv) {
+    const char *filename = argc>1 ? argv[1] : "../object/african_head/african_head.obj";
+    const int width = argc>3 ? atoi(argv[2]) : 800, height = argc>3 ? atoi(argv[3]) : 800;
+    Model model(filename);
+    if (!model.nfaces()) return 1;
+    model.diffusemap(); model.normalmap(); model.specularmap(); // keep the decoding out of the timings
+
+    Vec3f eye(1, 1, 3), center(0, 0, 0), up(0, 1, 0);
+    RenderContext forward(width, height), deferred(width, height);
+    for (RenderContext *ctx : {&forward, &deferred}) {
+        ctx->model = &model;
+        lookat(*ctx, eye, center, up);
+        viewport(*ctx, width/8, height/8, width*3/4, height*3/4);
+        projection(*ctx, -1.f/(eye-center).norm());
+    }
+    PhongShader shader;
+    shader.model = &model;
+    shader.mvp = forward.Projection*forward.ModelView;
+    shader.light = Vec3f(1, 1, 1).normalize();
+    shader.eye = eye;
+    DrawParams params;
+    params.cull_backfaces = true;
+
+    auto t0 = std::chrono::steady_clock::now();
+    DrawStats fstats = draw(forward, shader, params);
+    double tforward = ms_since(t0);
+
+    VertexCache clip;
+    VisibilityBuffer vis(width, height);
+    t0 = std::chrono::steady_clock::now();
+    clip.transform(model, shader.mvp);
+    DrawStats vstats = draw_visibility(deferred, clip, vis, params);
+    double tvis = ms_since(t0);
+    t0 = std::chrono::steady_clock::now();
+    long long shaded = shade(deferred, vis, shader);
+    double tshade = ms_since(t0);
+
+    int maxdiff = 0, differ = 0;
+    for (int y=0; y<height; y++)
+        for (int x=0; x<width; x++) {
+            TGAColor a = forward.framebuffer.get(x, y), b = deferred.framebuffer.get(x, y);
+            int d = 0;
+            for (int i=0; i<3; i++) d = std::max(d, std::abs(a[i]-b[i]));
+            maxdiff = std::max(maxdiff, d);
+            differ += d>0;
+        }
+    std::cout << "forward:  " << fstats.fragments << " fragments shaded, " << tforward << " ms" << std::endl
+              << "deferred: " << shaded << " pixels shaded (" << vstats.fragments << " visibility writes), "
+              << tvis << " ms visibility + " << tshade << " ms shading" << std::endl
+              << "overdraw avoided: " << (shaded ? (double)fstats.fragments/shaded : 0) << "x" << std::endl
+              << "pixels that differ: " << differ << ", max channel difference " << maxdiff << std::endl;
+    forward.framebuffer.to_image().write_tga_file("forward.tga", true, true);
+    deferred.framebuffer.to_image().write_tga_file("deferred.tga", true, true);
+    return 0;
+}
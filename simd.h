@@ -0,0 +1,92 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+// Thin wrapper over the widest float vector the target supports:
+// 8 lanes with AVX2, 4 with SSE2, 1 (plain float) otherwise.
+// Comparisons return a vfloat whose lanes are all ones or all zeros, to be consumed by
+// movemask(), select() or the bitwise operators.
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+struct vfloat {
+    static constexpr int N = 8;
+    __m256 v;
+    vfloat() : v(_mm256_setzero_ps()) {}
+    vfloat(__m256 x) : v(x) {}
+    vfloat(float x) : v(_mm256_set1_ps(x)) {}
+    static vfloat load(const float *p)  { return _mm256_loadu_ps(p); }
+    void store(float *p) const          { _mm256_storeu_ps(p, v); }
+    static vfloat ramp()                { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+};
+inline vfloat operator+(vfloat a, vfloat b)  { return _mm256_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b)  { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b)  { return _mm256_mul_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b)  { return _mm256_div_ps(a.v, b.v); }
+inline vfloat operator&(vfloat a, vfloat b)  { return _mm256_and_ps(a.v, b.v); }
+inline vfloat operator|(vfloat a, vfloat b)  { return _mm256_or_ps(a.v, b.v); }
+inline vfloat operator>=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline vfloat operator>(vfloat a, vfloat b)  { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline vfloat operator<(vfloat a, vfloat b)  { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline vfloat vmin(vfloat a, vfloat b)       { return _mm256_min_ps(a.v, b.v); }
+inline vfloat vmax(vfloat a, vfloat b)       { return _mm256_max_ps(a.v, b.v); }
+inline vfloat select(vfloat m, vfloat a, vfloat b) { return _mm256_blendv_ps(b.v, a.v, m.v); } // m ? a : b
+inline int movemask(vfloat m)                { return _mm256_movemask_ps(m.v); }
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+struct vfloat {
+    static constexpr int N = 4;
+    __m128 v;
+    vfloat() : v(_mm_setzero_ps()) {}
+    vfloat(__m128 x) : v(x) {}
+    vfloat(float x) : v(_mm_set1_ps(x)) {}
+    static vfloat load(const float *p)  { return _mm_loadu_ps(p); }
+    void store(float *p) const          { _mm_storeu_ps(p, v); }
+    static vfloat ramp()                { return _mm_setr_ps(0, 1, 2, 3); }
+};
+inline vfloat operator+(vfloat a, vfloat b)  { return _mm_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b)  { return _mm_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b)  { return _mm_mul_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b)  { return _mm_div_ps(a.v, b.v); }
+inline vfloat operator&(vfloat a, vfloat b)  { return _mm_and_ps(a.v, b.v); }
+inline vfloat operator|(vfloat a, vfloat b)  { return _mm_or_ps(a.v, b.v); }
+inline vfloat operator>=(vfloat a, vfloat b) { return _mm_cmpge_ps(a.v, b.v); }
+inline vfloat operator>(vfloat a, vfloat b)  { return _mm_cmpgt_ps(a.v, b.v); }
+inline vfloat operator<(vfloat a, vfloat b)  { return _mm_cmplt_ps(a.v, b.v); }
+inline vfloat vmin(vfloat a, vfloat b)       { return _mm_min_ps(a.v, b.v); }
+inline vfloat vmax(vfloat a, vfloat b)       { return _mm_max_ps(a.v, b.v); }
+inline vfloat select(vfloat m, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)); }
+inline int movemask(vfloat m)                { return _mm_movemask_ps(m.v); }
+
+#else
+#include <cstring>
+
+struct vfloat {
+    static constexpr int N = 1;
+    float v;
+    vfloat() : v(0) {}
+    vfloat(float x) : v(x) {}
+    static vfloat load(const float *p)  { return *p; }
+    void store(float *p) const          { *p = v; }
+    static vfloat ramp()                { return 0.f; }
+};
+inline vfloat vmask_(bool b) { float f; unsigned u = b ? ~0u : 0u; std::memcpy(&f, &u, 4); return f; }
+inline unsigned vbits_(vfloat a) { unsigned u; std::memcpy(&u, &a.v, 4); return u; }
+inline vfloat vfrombits_(unsigned u) { float f; std::memcpy(&f, &u, 4); return f; }
+inline vfloat operator+(vfloat a, vfloat b)  { return a.v+b.v; }
+inline vfloat operator-(vfloat a, vfloat b)  { return a.v-b.v; }
+inline vfloat operator*(vfloat a, vfloat b)  { return a.v*b.v; }
+inline vfloat operator/(vfloat a, vfloat b)  { return a.v/b.v; }
+inline vfloat operator&(vfloat a, vfloat b)  { return vfrombits_(vbits_(a)&vbits_(b)); }
+inline vfloat operator|(vfloat a, vfloat b)  { return vfrombits_(vbits_(a)|vbits_(b)); }
+inline vfloat operator>=(vfloat a, vfloat b) { return vmask_(a.v>=b.v); }
+inline vfloat operator>(vfloat a, vfloat b)  { return vmask_(a.v>b.v); }
+inline vfloat operator<(vfloat a, vfloat b)  { return vmask_(a.v<b.v); }
+inline vfloat vmin(vfloat a, vfloat b)       { return a.v<b.v ? a : b; }
+inline vfloat vmax(vfloat a, vfloat b)       { return a.v>b.v ? a : b; }
+inline vfloat select(vfloat m, vfloat a, vfloat b) { return vbits_(m) ? a : b; }
+inline int movemask(vfloat m)                { return vbits_(m)>>31; }
+#endif
+
+#endif //__SIMD_H__
@@ -0,0 +1,80 @@
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include "ssao.h"
+#include "simd.h"
+#include "parallel.h"
+#include "profile.h"
+
+namespace {
+    const int ROWS_PER_TASK = 8;
+
+    // The march along a direction visits the pixels containing the ray points p+dir*t, t=1,2,..
+    // (the epsilon keeps cos(pi/2)-like rounding noise from shifting a whole direction by one pixel).
+    // Unlike the original per-pixel loop, the sample at t=1 is always taken: that loop measured |dir*t| in
+    // float and skipped distances below 1, which dropped t=1 on most diagonal directions. Pixels next to
+    // a depth step come out darker (about 50k of the 178k covered pixels of african_head, up to 40/255).
+    // Offsets are monotonic in t, so the march stops for good at the first offset leaving the image.
+    struct Direction {
+        std::vector<int> dx, dy; // dx[t-1], dy[t-1]: offset of the sample at distance t
+    };
+}
+
+void ssao(const float *zbuffer, int width, int height, float *ao, const SSAOParams &params) {
+    PROFILE_SCOPE("ssao");
+    const int N = vfloat::N;
+    const int nsamples = std::max(1, params.nsamples), radius = std::max(1, params.radius);
+    std::vector<Direction> dirs(nsamples);
+    for (int d=0; d<nsamples; d++) {
+        float a = 2*M_PI*d/nsamples;
+        for (int t=1; t<radius; t++) {
+            dirs[d].dx.push_back((int)std::floor(std::cos(a)*t+1e-4f));
+            dirs[d].dy.push_back((int)std::floor(std::sin(a)*t+1e-4f));
+        }
+    }
+    std::vector<float> invdist(radius);
+    for (int t=1; t<radius; t++) invdist[t-1] = 1.f/t;
+
+    // the elevation angle is atan(dz/t), so the largest slope dz/t gives the horizon: one atan per direction
+    auto occlusion = [&](int x, int y, int n, float *total) { // n<=N pixels starting at (x,y)
+        float samples[vfloat::N];
+        for (int i=0; i<N; i++) samples[i] = i<n ? zbuffer[x+i+y*width] : -std::numeric_limits<float>::max();
+        const vfloat zp = vfloat::load(samples);
+        for (int i=0; i<N; i++) total[i] = 0;
+        for (const Direction &dir : dirs) {
+            vfloat maxslope(0.f);
+            for (int t=0; t<radius-1; t++) {
+                int sy = y+dir.dy[t], sx = x+dir.dx[t];
+                if (sy<0 || sy>=height || sx+N<=0 || sx>=width) break;
+                vfloat z;
+                if (sx>=0 && sx+N<=width) {
+                    z = vfloat::load(zbuffer+sx+sy*width);
+                } else { // the group straddles the left or the right border
+                    for (int i=0; i<N; i++)
+                        samples[i] = (sx+i>=0 && sx+i<width) ? zbuffer[sx+i+sy*width] : -std::numeric_limits<float>::max();
+                    z = vfloat::load(samples);
+                }
+                maxslope = vmax(maxslope, (z-zp)*vfloat(invdist[t]));
+            }
+            maxslope.store(samples);
+            for (int i=0; i<N; i++) total[i] += M_PI/2 - std::atan(samples[i]);
+        }
+        for (int i=0; i<N; i++) total[i] /= (M_PI/2)*nsamples;
+    };
+
+    parallel_for((height+ROWS_PER_TASK-1)/ROWS_PER_TASK, params.nthreads, [&](int task) {
+        float total[vfloat::N];
+        for (int y=task*ROWS_PER_TASK; y<std::min(height, (task+1)*ROWS_PER_TASK); y++) {
+            const float *row = zbuffer+y*width;
+            for (int x=0; x<width; x+=N) {
+                int n = std::min(N, width-x), covered = 0;
+                for (int i=0; i<n; i++) covered |= (row[x+i]>=-1e5) << i;
+                if (!covered) continue;
+                occlusion(x, y, n, total);
+                for (int i=0; i<n; i++)
+                    if (covered>>i & 1) ao[x+i+y*width] = total[i];
+            }
+        }
+    });
+}
@@ -0,0 +1,15 @@
+#ifndef __SSAO_H__
+#define __SSAO_H__
+
+struct SSAOParams {
+    int nsamples = 8;    // marching directions per pixel, at least 1
+    int radius   = 1000; // march length in pixels, at least 1
+    int nthreads = 0;    // 0 = all cores
+};
+
+// Screen-space ambient occlusion of a depth buffer (larger depth = closer to the camera).
+// For every covered pixel (depth > -1e5) the horizon is searched along nsamples directions and
+// ao[x+y*width] receives the mean of (pi/2 - horizon elevation)/(pi/2): 1 is fully open, 0 fully occluded.
+// Uncovered pixels are left untouched.
+void ssao(const float *zbuffer, int width, int height, float *ao, const SSAOParams &params=SSAOParams());
+#endif //__SSAO_H__
@@ -0,0 +1,121 @@
+#include <cmath>
+#include <algorithm>
+#include "texture.h"
+
+static const int TEX_TILE = 8; // texels per tile side, 8x8x4 bytes = 4 cache lines
+
+// bits of a 3-bit coordinate spread to the even positions of a 6-bit Morton code
+static const int morton3[TEX_TILE] = {0, 1, 4, 5, 16, 17, 20, 21};
+
+Texture::Texture() : levels_(), bytespp_(1) {}
+
+const unsigned char *Texture::texel(const Level &l, int x, int y) const {
+    unsigned ux = std::clamp(x, 0, l.width-1), uy = std::clamp(y, 0, l.height-1);
+    unsigned tile = ux/TEX_TILE + (uy/TEX_TILE)*l.tilesx;
+    return l.texels.data() + (tile*TEX_TILE*TEX_TILE + (morton3[ux%TEX_TILE] | morton3[uy%TEX_TILE]<<1))*4;
+}
+
+bool Texture::load(const TGAImage &img) {
+    levels_.clear();
+    int w = img.get_width(), h = img.get_height();
+    if (w<=0 || h<=0) return false;
+    bytespp_ = img.get_bytespp();
+    for (;;) {
+        Level l;
+        l.width  = w;
+        l.height = h;
+        l.tilesx = (w+TEX_TILE-1)/TEX_TILE;
+        l.texels.assign(l.tilesx*((h+TEX_TILE-1)/TEX_TILE)*TEX_TILE*TEX_TILE*4, 0);
+        levels_.push_back(std::move(l));
+        Level &dst = levels_.back();
+        for (int y=0; y<h; y++) {
+            for (int x=0; x<w; x++) {
+                unsigned char *p = const_cast<unsigned char *>(texel(dst, x, y));
+                if (levels_.size()==1) {
+                    TGAColor c = img.get(x, y);
+                    for (int i=0; i<4; i++) p[i] = c.bgra[i];
+                    continue;
+                }
+                // 2x2 box filter of the previous level, the last row/column of an odd size is clamped
+                const Level &src = levels_[levels_.size()-2];
+                const unsigned char *q[4] = {texel(src, 2*x, 2*y), texel(src, 2*x+1, 2*y), texel(src, 2*x, 2*y+1), texel(src, 2*x+1, 2*y+1)};
+                for (int i=0; i<4; i++)
+                    p[i] = (q[0][i] + q[1][i] + q[2][i] + q[3][i] + 2)/4;
+            }
+        }
+        if (w==1 && h==1) break;
+        w = std::max(1, w/2);
+        h = std::max(1, h/2);
+    }
+    return true;
+}
+
+size_t Texture::memory() const {
+    size_t bytes = 0;
+    for (const Level &l : levels_) bytes += l.texels.size();
+    return bytes;
+}
+
+float Texture::lod(Vec2f duvdx, Vec2f duvdy) const {
+    if (empty()) return 0.f;
+    float w = levels_[0].width, h = levels_[0].height;
+    float dx = std::hypot(duvdx[0]*w, duvdx[1]*h);
+    float dy = std::hypot(duvdy[0]*w, duvdy[1]*h);
+    float rho = std::max(dx, dy);
+    return rho>0.f ? std::log2(rho) : 0.f;
+}
+
+TGAColor Texture::fetch(int x, int y, int level) const {
+    if (empty()) return TGAColor();
+    return TGAColor(texel(levels_[std::clamp(level, 0, levels()-1)], x, y), bytespp_);
+}
+
+void Texture::bilinear(const Level &l, Vec2f uv, float res[4]) const {
+    float x = uv[0]*l.width - .5f, y = uv[1]*l.height - .5f;
+    int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+    float fx = x-x0, fy = y-y0;
+    const unsigned char *p00 = texel(l, x0, y0),   *p10 = texel(l, x0+1, y0);
+    const unsigned char *p01 = texel(l, x0, y0+1), *p11 = texel(l, x0+1, y0+1);
+    for (int i=0; i<4; i++) {
+        float top    = p00[i] + (p10[i]-p00[i])*fx;
+        float bottom = p01[i] + (p11[i]-p01[i])*fx;
+        res[i] = top + (bottom-top)*fy;
+    }
+}
+
+TGAColor Texture::sample(Vec2f uv, float lod, TextureFilter filter) const {
+    if (empty()) return TGAColor();
+    lod = std::clamp(lod, 0.f, (float)levels()-1);
+    if (filter==NEAREST) {
+        const Level &l = levels_[(int)(lod+.5f)];
+        return TGAColor(texel(l, (int)(uv[0]*l.width), (int)(uv[1]*l.height)), bytespp_);
+    }
+    float c[4];
+    if (filter==BILINEAR) {
+        bilinear(levels_[(int)(lod+.5f)], uv, c);
+    } else {
+        int l0 = (int)lod, l1 = std::min(l0+1, levels()-1);
+        float t = lod-l0, c1[4];
+        bilinear(levels_[l0], uv, c);
+        bilinear(levels_[l1], uv, c1);
+        for (int i=0; i<4; i++) c[i] += (c1[i]-c[i])*t;
+    }
+    unsigned char bgra[4];
+    for (int i=0; i<4; i++) bgra[i] = (unsigned char)std::clamp(c[i]+.5f, 0.f, 255.f);
+    return TGAColor(bgra, bytespp_);
+}
+
+void uv_derivatives(const Vec2f pts[3], const Vec2f uv[3], Vec2f &duvdx, Vec2f &duvdy) {
+    Vec2f e1 = pts[1]-pts[0], e2 = pts[2]-pts[0];
+    Vec2f t1 = uv[1]-uv[0],   t2 = uv[2]-uv[0];
+    float det = e1[0]*e2[1] - e2[0]*e1[1];
+    if (std::abs(det)<1e-12f) {
+        duvdx = duvdy = Vec2f(0, 0);
+        return;
+    }
+    // uv(p) = uv0 + [t1 t2] * inverse([e1 e2]) * (p-p0)
+    for (int i=0; i<2; i++) {
+        duvdx[i] = ( t1[i]*e2[1] - t2[i]*e1[1])/det;
+        duvdy[i] = (-t1[i]*e2[0] + t2[i]*e1[0])/det;
+    }
+}
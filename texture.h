@@ -0,0 +1,46 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+
+enum TextureFilter {
+    NEAREST,   // nearest texel of the nearest level
+    BILINEAR,  // 2x2 texels of the nearest level
+    TRILINEAR  // bilinear in the two closest levels, blended
+};
+
+// Mipmapped texture built from a TGAImage. Every level stores 4 bytes per texel (the bgra of TGAColor)
+// in 8x8 texel tiles with the texels in Morton order inside a tile: a bilinear footprint stays within
+// one or two cache lines instead of straddling two image rows, whatever the orientation of the triangle.
+class Texture {
+public:
+    Texture();
+    bool load(const TGAImage &img); // builds the whole mip chain, false on an empty image
+    bool empty() const { return levels_.empty(); }
+    int levels() const { return (int)levels_.size(); }
+    int width(int level=0) const  { return levels_[level].width; }
+    int height(int level=0) const { return levels_[level].height; }
+    size_t memory() const; // bytes of texels, all levels
+
+    // level of detail for a pixel footprint given the screen-space derivatives of uv
+    float lod(Vec2f duvdx, Vec2f duvdy) const;
+    // uv in [0,1]^2, texel x = u*width, y = v*height, clamped to the edges
+    TGAColor sample(Vec2f uv, float lod=0.f, TextureFilter filter=NEAREST) const;
+    TGAColor fetch(int x, int y, int level=0) const; // clamped texel lookup
+private:
+    struct Level {
+        int width, height, tilesx;
+        std::vector<unsigned char> texels;
+    };
+    std::vector<Level> levels_;
+    int bytespp_;
+
+    const unsigned char *texel(const Level &l, int x, int y) const;
+    void bilinear(const Level &l, Vec2f uv, float res[4]) const;
+};
+
+// screen-space derivatives of the uv across a triangle, pts being its screen coordinates;
+// zero for a degenerate triangle
+void uv_derivatives(const Vec2f pts[3], const Vec2f uv[3], Vec2f &duvdx, Vec2f &duvdy);
+#endif //__TEXTURE_H__
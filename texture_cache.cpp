@@ -0,0 +1,87 @@
+#include <iostream>
+#include "texture_cache.h"
+
+TextureCache::TextureCache() : mutex_(), lru_(), index_(), budget_(256u<<20), memory_(0) {}
+
+TextureCache &TextureCache::instance() {
+    static TextureCache cache;
+    return cache;
+}
+
+std::shared_ptr<const Texture> TextureCache::acquire(const std::string &path) {
+    std::shared_ptr<Slot> slot;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(path);
+        if (it!=index_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+        } else {
+            lru_.emplace_front(path, std::make_shared<Slot>());
+            index_[path] = lru_.begin();
+        }
+        slot = lru_.front().second;
+        if (slot->texture) return slot->texture;
+    }
+
+    std::lock_guard<std::mutex> load(slot->load);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (slot->texture) return slot->texture; // decoded by another thread meanwhile
+    }
+    TGAImage img;
+    bool ok = img.read_tga_file(path.c_str());
+    std::cerr << "texture file " << path << " loading " << (ok ? "ok" : "failed") << std::endl;
+    img.flip_vertically();
+    std::shared_ptr<Texture> texture = std::make_shared<Texture>();
+    if (ok) texture->load(img);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    slot->texture = texture;
+    if (slot->cached) {
+        slot->bytes = texture->memory();
+        memory_ += slot->bytes;
+        evict_locked(budget_, 1);
+    }
+    return texture;
+}
+
+void TextureCache::evict_locked(size_t bytes, size_t keep) {
+    LRU::iterator it = lru_.end();
+    for (size_t pos=lru_.size(); memory_>bytes && pos>keep; ) { // pos: index of it in lru_
+        --it; pos--;
+        if (it->second->texture.use_count()>1) continue; // held outside the cache
+        it->second->cached = false;
+        memory_ -= it->second->bytes;
+        index_.erase(it->first);
+        it = lru_.erase(it);
+    }
+}
+
+void TextureCache::set_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = bytes;
+    evict_locked(budget_, 0);
+}
+
+size_t TextureCache::budget() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return budget_;
+}
+
+size_t TextureCache::memory() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return memory_;
+}
+
+void TextureCache::evict(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    evict_locked(bytes, 0);
+}
+
+void TextureCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &entry : lru_) entry.second->cached = false;
+    lru_.clear();
+    index_.clear();
+    memory_ = 0;
+}
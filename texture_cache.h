@@ -0,0 +1,43 @@
+#ifndef __TEXTURE_CACHE_H__
+#define __TEXTURE_CACHE_H__
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "texture.h"
+
+// Process-wide cache of decoded textures keyed by file path, so meshes sharing a map share one copy.
+// A texture is read (and flipped to the uv convention of the models) the first time it is acquired.
+// Once the decoded textures exceed the memory budget the least recently acquired ones that nobody else holds
+// are dropped from the cache: a texture still in use stays cached (and counted), since dropping it would free
+// nothing and make the next acquire() decode a second copy. Files that fail to load are cached as empty
+// textures, which sample as black.
+class TextureCache {
+public:
+    static TextureCache &instance();
+
+    std::shared_ptr<const Texture> acquire(const std::string &path);
+    void set_budget(size_t bytes); // evicts right away if needed
+    size_t budget() const;
+    size_t memory() const;         // bytes of texels currently held by the cache
+    void evict(size_t bytes);      // drops least recently used unheld textures until at most bytes are held
+    void clear();
+private:
+    struct Slot {
+        std::mutex load;           // held while decoding, so concurrent first users wait instead of decoding twice
+        std::shared_ptr<const Texture> texture;
+        size_t bytes = 0;
+        bool cached = true;        // false once evicted
+    };
+    typedef std::list<std::pair<std::string, std::shared_ptr<Slot>>> LRU; // most recently used first
+
+    mutable std::mutex mutex_;
+    LRU lru_;
+    std::unordered_map<std::string, LRU::iterator> index_;
+    size_t budget_, memory_;
+
+    TextureCache();
+    void evict_locked(size_t bytes, size_t keep); // never drops the keep most recently used nor held textures
+};
+#endif //__TEXTURE_CACHE_H__
@@ -0,0 +1,84 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "tgaimage.h"
+
+// TGA codec round-trip and throughput: every image is read, written back RLE-encoded (top-down and
+// bottom-up) and raw, then re-read and compared pixel by pixel.
+// usage: tga-bench [image.tga...], defaults to the african_head textures and a synthetic 4096x4096 frame
+
+static double ms_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-t0).count();
+}
+
+static bool same_pixels(const TGAImage &a, const TGAImage &b) {
+    if (a.get_width()!=b.get_width() || a.get_height()!=b.get_height() || a.get_bytespp()!=b.get_bytespp()) return false;
+    for (int y=0; y<a.get_height(); y++)
+        for (int x=0; x<a.get_width(); x++)
+            if (memcmp(a.get(x, y).bgra, b.get(x, y).bgra, a.get_bytespp())) return false;
+    return true;
+}
+
+// flat shaded bands and a noisy region, roughly what a rendered frame compresses like
+static TGAImage synthetic_frame(int w, int h) {
+    TGAImage img(w, h, TGAImage::RGB);
+    unsigned seed = 1;
+    for (int y=0; y<h; y++)
+        for (int x=0; x<w; x++) {
+            unsigned char v = (x/64 + y/64)*16;
+            if (x>w/2 && y>h/2) v = (seed = seed*1664525u+1013904223u)>>24;
+            img.set(x, y, TGAColor(v, v, v));
+        }
+    return img;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> files;
+    for (int i=1; i<argc; i++) files.push_back(argv[i]);
+    const bool synthetic = files.empty();
+    if (synthetic) {
+        const char *names[] = {"diffuse", "nm", "nm_tangent", "spec"};
+        for (const char *n : names) files.push_back(std::string("../object/african_head/african_head_") + n + ".tga");
+        synthetic_frame(4096, 4096).write_tga_file("tga_bench_synthetic.tga");
+        files.push_back("tga_bench_synthetic.tga");
+    }
+    std::cout << "file,width,height,bpp,read_ms,write_rle_ms,write_rle_bottom_up_ms,write_raw_ms,read_MBps,write_MBps,round_trip" << std::endl;
+    bool all_ok = true;
+    for (const std::string &f : files) {
+        TGAImage img;
+        auto t0 = std::chrono::steady_clock::now();
+        if (!img.read_tga_file(f.c_str())) {
+            all_ok = false;
+            continue;
+        }
+        double read_ms = ms_since(t0);
+        t0 = std::chrono::steady_clock::now();
+        img.write_tga_file("tga_bench_rle.tga");
+        double rle_ms = ms_since(t0);
+        TGAImage flipped = img;
+        flipped.flip_vertically();
+        t0 = std::chrono::steady_clock::now();
+        flipped.write_tga_file("tga_bench_bottom_up.tga", true, true);
+        double bottom_up_ms = ms_since(t0);
+        t0 = std::chrono::steady_clock::now();
+        img.write_tga_file("tga_bench_raw.tga", false);
+        double raw_ms = ms_since(t0);
+
+        TGAImage rle, bottom_up, raw;
+        bool ok = rle.read_tga_file("tga_bench_rle.tga") && bottom_up.read_tga_file("tga_bench_bottom_up.tga") && raw.read_tga_file("tga_bench_raw.tga")
+               && same_pixels(img, rle) && same_pixels(img, bottom_up) && same_pixels(img, raw);
+        all_ok = all_ok && ok;
+        double mb = (double)img.get_width()*img.get_height()*img.get_bytespp()/(1024.*1024.);
+        std::cout << f << "," << img.get_width() << "," << img.get_height() << "," << img.get_bytespp()*8 << ","
+                  << read_ms << "," << rle_ms << "," << bottom_up_ms << "," << raw_ms << ","
+                  << mb/read_ms*1e3 << "," << mb/rle_ms*1e3 << "," << (ok ? "ok" : "FAILED") << std::endl;
+    }
+    remove("tga_bench_rle.tga");
+    remove("tga_bench_bottom_up.tga");
+    remove("tga_bench_raw.tga");
+    if (synthetic) remove("tga_bench_synthetic.tga");
+    return all_ok ? 0 : 1;
+}
@@ -3,7 +3,15 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
 #include "tgaimage.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "profile.h"
+
+static const int RLE_BAND = 32; // rows per parallel RLE task
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {}
 
@@ -39,109 +47,116 @@ TGAImage & TGAImage::operator =(const TGAImage &img) {
 bool TGAImage::read_tga_file(const char *filename) {
     if (data) delete [] data;
     data = NULL;
-    std::ifstream in;
-    in.open (filename, std::ios::binary);
-    if (!in.is_open()) {
+    MappedFile file;
+    if (!file.open(filename)) {
         std::cerr << "can't open file " << filename << "\n";
-        in.close();
         return false;
     }
     TGA_Header header;
-    in.read((char *)&header, sizeof(header));
-    if (!in.good()) {
-        in.close();
+    if (file.size()<sizeof(header)) {
         std::cerr << "an error occured while reading the header\n";
         return false;
     }
+    memcpy(&header, file.data(), sizeof(header));
     width   = header.width;
     height  = header.height;
     bytespp = header.bitsperpixel>>3;
     if (width<=0 || height<=0 || (bytespp!=GRAYSCALE && bytespp!=RGB && bytespp!=RGBA)) {
-        in.close();
         std::cerr << "bad bpp (or width/height) value\n";
         return false;
     }
-    unsigned long nbytes = bytespp*width*height;
-    data = new unsigned char[nbytes];
+    size_t offset = sizeof(header) + (unsigned char)header.idlength;
+    const unsigned char *in = (const unsigned char *)file.data() + std::min(offset, file.size());
+    size_t size = file.size() - std::min(offset, file.size());
+    // rows land directly in their final place: no flip for bottom-left origin files
+    const bool bottom_up = !(header.imagedescriptor & 0x20);
+    unsigned long bytes_per_line = width*bytespp;
+    data = new unsigned char[bytes_per_line*height];
     if (3==header.datatypecode || 2==header.datatypecode) {
-        in.read((char *)data, nbytes);
-        if (!in.good()) {
-            in.close();
+        if (size<bytes_per_line*height) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
+        for (int y=0; y<height; y++)
+            memcpy(data+(bottom_up ? height-1-y : y)*bytes_per_line, in+y*bytes_per_line, bytes_per_line);
     } else if (10==header.datatypecode||11==header.datatypecode) {
-        if (!load_rle_data(in)) {
-            in.close();
+        if (!load_rle_data(in, size, bottom_up)) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
     } else {
-        in.close();
         std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
         return false;
     }
-    if (!(header.imagedescriptor & 0x20)) {
-        flip_vertically();
-    }
     if (header.imagedescriptor & 0x10) {
         flip_horizontally();
     }
     std::cerr << width << "x" << height << "/" << bytespp*8 << "\n";
-    in.close();
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-    unsigned long pixelcount = width*height;
-    unsigned long currentpixel = 0;
-    unsigned long currentbyte  = 0;
-    TGAColor colorbuffer;
-    do {
-        unsigned char chunkheader = 0;
-        chunkheader = in.get();
-        if (!in.good()) {
-            std::cerr << "an error occured while reading the data\n";
-            return false;
-        }
-        if (chunkheader<128) {
-            chunkheader++;
-            for (int i=0; i<chunkheader; i++) {
-                in.read((char *)colorbuffer.bgra, bytespp);
-                if (!in.good()) {
-                    std::cerr << "an error occured while reading the header\n";
-                    return false;
-                }
-                for (int t=0; t<bytespp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel>pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
-            }
-        } else {
-            chunkheader -= 127;
-            in.read((char *)colorbuffer.bgra, bytespp);
-            if (!in.good()) {
+// Pixels are decoded in bands of RLE_BAND rows in parallel. A first pass only hops from packet header to
+// packet header to find where each band starts in the stream (packets may straddle bands and rows).
+bool TGAImage::load_rle_data(const unsigned char *in, size_t size, bool bottom_up) {
+    const unsigned long pixelcount = (unsigned long)width*height;
+    const int nbands = (height+RLE_BAND-1)/RLE_BAND;
+    std::vector<size_t> band_offset(nbands);
+    std::vector<unsigned long> band_skip(nbands); // pixels of the first packet that belong to the previous band
+    size_t pos = 0;
+    unsigned long pixel = 0;
+    for (int b=0; b<nbands; b++) {
+        unsigned long start = (unsigned long)b*RLE_BAND*width;
+        for (;;) {
+            if (pos>=size) {
                 std::cerr << "an error occured while reading the header\n";
                 return false;
             }
-            for (int i=0; i<chunkheader; i++) {
-                for (int t=0; t<bytespp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel>pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
+            unsigned long n = (in[pos] & 0x7f) + 1;
+            if (pixel+n>start) break;
+            pos += 1 + (in[pos]<128 ? n*bytespp : bytespp);
+            pixel += n;
+        }
+        band_offset[b] = pos;
+        band_skip[b] = start-pixel;
+    }
+
+    std::atomic<bool> ok(true);
+    parallel_for(nbands, 0, [&](int b) {
+        unsigned long p = (unsigned long)b*RLE_BAND*width;
+        const unsigned long end = std::min(p + (unsigned long)RLE_BAND*width, pixelcount);
+        size_t pos = band_offset[b];
+        unsigned long skip = band_skip[b];
+        while (p<end) {
+            if (pos>=size) { ok = false; return; }
+            const bool raw = in[pos]<128;
+            unsigned long n = (in[pos] & 0x7f) + 1;
+            const size_t payload = raw ? n*bytespp : bytespp;
+            if (pos+1+payload>size) { ok = false; return; }
+            const unsigned char *src = in + pos + 1 + (raw ? skip*bytespp : 0);
+            pos += 1 + payload;
+            n = std::min(n-skip, end-p);
+            skip = 0;
+            while (n) { // split at the row ends
+                unsigned long y = p/width, x = p%width, m = std::min(n, (unsigned long)width-x);
+                unsigned char *dst = data + ((bottom_up ? height-1-y : y)*width + x)*bytespp;
+                if (raw) {
+                    memcpy(dst, src, m*bytespp);
+                    src += m*bytespp;
+                } else if (bytespp==1) {
+                    memset(dst, *src, m);
+                } else {
+                    for (unsigned long i=0; i<m; i++) memcpy(dst+i*bytespp, src, bytespp);
                 }
+                p += m;
+                n -= m;
             }
         }
-    } while (currentpixel < pixelcount);
-    return true;
+    });
+    return ok;
 }
 
-bool TGAImage::write_tga_file(const char *filename, bool rle) {
+bool TGAImage::write_tga_file(const char *filename, bool rle, bool bottom_up) {
+    PROFILE_SCOPE("write_tga");
     unsigned char developer_area_ref[4] = {0, 0, 0, 0};
     unsigned char extension_area_ref[4] = {0, 0, 0, 0};
     unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
@@ -158,7 +173,7 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
     header.width  = width;
     header.height = height;
     header.datatypecode = (bytespp==GRAYSCALE?(rle?11:3):(rle?10:2));
-    header.imagedescriptor = 0x20; // top-left origin
+    header.imagedescriptor = bottom_up ? 0x00 : 0x20; // bottom-left or top-left origin
     out.write((char *)&header, sizeof(header));
     if (!out.good()) {
         out.close();
@@ -201,41 +216,44 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
     return true;
 }
 
+// Bands of RLE_BAND rows are encoded in parallel into separate buffers, packets never cross a band.
 // TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
 bool TGAImage::unload_rle_data(std::ofstream &out) {
     const unsigned char max_chunk_length = 128;
-    unsigned long npixels = width*height;
-    unsigned long curpix = 0;
-    while (curpix<npixels) {
-        unsigned long chunkstart = curpix*bytespp;
-        unsigned long curbyte = curpix*bytespp;
-        unsigned char run_length = 1;
-        bool raw = true;
-        while (curpix+run_length<npixels && run_length<max_chunk_length) {
-            bool succ_eq = true;
-            for (int t=0; succ_eq && t<bytespp; t++) {
-                succ_eq = (data[curbyte+t]==data[curbyte+t+bytespp]);
-            }
-            curbyte += bytespp;
-            if (1==run_length) {
-                raw = !succ_eq;
-            }
-            if (raw && succ_eq) {
-                run_length--;
-                break;
-            }
-            if (!raw && !succ_eq) {
-                break;
+    const int nbands = (height+RLE_BAND-1)/RLE_BAND;
+    std::vector<std::vector<unsigned char>> bands(nbands);
+    parallel_for(nbands, 0, [&](int b) {
+        std::vector<unsigned char> &buf = bands[b];
+        unsigned long curpix  = (unsigned long)b*RLE_BAND*width;
+        unsigned long npixels = std::min(curpix + (unsigned long)RLE_BAND*width, (unsigned long)width*height);
+        buf.reserve((npixels-curpix)*bytespp + (npixels-curpix)/max_chunk_length + 1);
+        while (curpix<npixels) {
+            unsigned long chunkstart = curpix*bytespp;
+            unsigned long curbyte = curpix*bytespp;
+            unsigned char run_length = 1;
+            bool raw = true;
+            while (curpix+run_length<npixels && run_length<max_chunk_length) {
+                bool succ_eq = !memcmp(data+curbyte, data+curbyte+bytespp, bytespp);
+                curbyte += bytespp;
+                if (1==run_length) {
+                    raw = !succ_eq;
+                }
+                if (raw && succ_eq) {
+                    run_length--;
+                    break;
+                }
+                if (!raw && !succ_eq) {
+                    break;
+                }
+                run_length++;
             }
-            run_length++;
-        }
-        curpix += run_length;
-        out.put(raw?run_length-1:run_length+127);
-        if (!out.good()) {
-            std::cerr << "can't dump the tga file\n";
-            return false;
+            curpix += run_length;
+            buf.push_back(raw?run_length-1:run_length+127);
+            buf.insert(buf.end(), data+chunkstart, data+chunkstart+(raw?run_length*bytespp:bytespp));
         }
-        out.write((char *)(data+chunkstart), (raw?run_length*bytespp:bytespp));
+    });
+    for (const std::vector<unsigned char> &buf : bands) {
+        out.write((const char *)buf.data(), buf.size());
         if (!out.good()) {
             std::cerr << "can't dump the tga file\n";
             return false;
@@ -244,7 +262,7 @@ bool TGAImage::unload_rle_data(std::ofstream &out) {
     return true;
 }
 
-TGAColor TGAImage::get(int x, int y) {
+TGAColor TGAImage::get(int x, int y) const {
     if (!data || x<0 || y<0 || x>=width || y>=height) {
         return TGAColor();
     }
@@ -267,15 +285,15 @@ bool TGAImage::set(int x, int y, const TGAColor &c) {
     return true;
 }
 
-int TGAImage::get_bytespp() {
+int TGAImage::get_bytespp() const {
     return bytespp;
 }
 
-int TGAImage::get_width() {
+int TGAImage::get_width() const {
     return width;
 }
 
-int TGAImage::get_height() {
+int TGAImage::get_height() const {
     return height;
 }
 
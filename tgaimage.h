@@ -1,6 +1,7 @@
 #ifndef __IMAGE_H__
 #define __IMAGE_H__
 
+#include <cstddef>
 #include <fstream>
 
 #pragma pack(push,1)
@@ -67,7 +68,7 @@ protected:
     int height;
     int bytespp;
 
-    bool   load_rle_data(std::ifstream &in);
+    bool   load_rle_data(const unsigned char *in, size_t size, bool bottom_up);
     bool unload_rle_data(std::ofstream &out);
 public:
     enum Format {
@@ -78,18 +79,19 @@ public:
     TGAImage(int w, int h, int bpp);
     TGAImage(const TGAImage &img);
     bool read_tga_file(const char *filename);
-    bool write_tga_file(const char *filename, bool rle=true);
+    // bottom_up: row 0 is the bottom of the picture, written as is with a bottom-left origin instead of flipping
+    bool write_tga_file(const char *filename, bool rle=true, bool bottom_up=false);
     bool flip_horizontally();
     bool flip_vertically();
     bool scale(int w, int h);
-    TGAColor get(int x, int y);
+    TGAColor get(int x, int y) const;
     bool set(int x, int y, TGAColor &c);
     bool set(int x, int y, const TGAColor &c);
     ~TGAImage();
     TGAImage & operator =(const TGAImage &img);
-    int get_width();
-    int get_height();
-    int get_bytespp();
+    int get_width() const;
+    int get_height() const;
+    int get_bytespp() const;
     unsigned char *buffer();
     void clear();
 };
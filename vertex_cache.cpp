@@ -0,0 +1,31 @@
+#include "vertex_cache.h"
+#include "parallel.h"
+#include "simd.h"
+#include "profile.h"
+
+// Each row is accumulated in the order of operator*(mat,vec) (last column first),
+// so the cached coordinates are bit-identical to m*embed<4>(model.vert(i)).
+void VertexCache::transform(const Model &model, const Matrix &m, int nthreads) {
+    transform(model, std::vector<Matrix>(1, m), nthreads);
+}
+
+void VertexCache::transform(const Model &model, const std::vector<Matrix> &matrices, int nthreads) {
+    PROFILE_SCOPE("vertex_transform");
+    const int n = model.nverts(), N = vfloat::N, BATCH = 4096, nbatches = (n+BATCH-1)/BATCH;
+    const float *px = model.positions(0), *py = model.positions(1), *pz = model.positions(2);
+    for (std::vector<float> *a : {&x, &y, &z, &w}) a->resize((size_t)n*matrices.size());
+    parallel_for(nbatches*(int)matrices.size(), nthreads, [&](int job) {
+        const Matrix &m = matrices[job/nbatches];
+        float *out[4] = {x.data(), y.data(), z.data(), w.data()};
+        for (float *&o : out) o += (size_t)n*(job/nbatches);
+        int i = (job%nbatches)*BATCH, end = std::min(n, i+BATCH);
+        for (; i+N<=end; i+=N) {
+            vfloat vx = vfloat::load(px+i), vy = vfloat::load(py+i), vz = vfloat::load(pz+i);
+            for (int r=0; r<4; r++)
+                (vfloat(m[r][3]) + vfloat(m[r][2])*vz + vfloat(m[r][1])*vy + vfloat(m[r][0])*vx).store(out[r]+i);
+        }
+        for (; i<end; i++)
+            for (int r=0; r<4; r++)
+                out[r][i] = m[r][3] + m[r][2]*pz[i] + m[r][1]*py[i] + m[r][0]*px[i];
+    });
+}
@@ -0,0 +1,24 @@
+#ifndef __VERTEX_CACHE_H__
+#define __VERTEX_CACHE_H__
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+
+// Post-transform vertex cache: the clip coordinates of every vertex of a model, computed once per frame
+// instead of once per face corner (about six times on a closed mesh). Shaders gather them by index.
+struct VertexCache {
+    std::vector<float> x, y, z, w;
+
+    // transforms all the vertices by m (e.g. Projection*ModelView), vfloat::N vertices at a time
+    void transform(const Model &model, const Matrix &m, int nthreads=0);
+    // instancing: one copy of the vertices per matrix, copy k at [k*model.nverts(), (k+1)*model.nverts()),
+    // all of them transformed in a single parallel pass
+    void transform(const Model &model, const std::vector<Matrix> &m, int nthreads=0);
+    Vec4f operator[](int i) const {
+        Vec4f v;
+        v[0] = x[i]; v[1] = y[i]; v[2] = z[i]; v[3] = w[i];
+        return v;
+    }
+    int size() const { return (int)x.size(); }
+};
+#endif //__VERTEX_CACHE_H__